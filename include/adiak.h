@@ -198,7 +198,13 @@ typedef struct adiak_datatype_t {
    int num_subtypes;
    /** \brief List of subtypes of container types. NULL for other types. */
    struct adiak_datatype_t **subtype;
-   /** \brief 1 if this a reference (i.e., zero-copy) entry, 0 if not */
+   /** \brief 1 if this a reference (i.e., zero-copy) entry, 0 if not
+    *
+    * Once a tool registered with adiak_version 2, Adiak stores copies of
+    * numeric lists and sets as packed arrays at the elements' native width,
+    * in the same layout as reference entries. These have \a is_reference
+    * set to 2. See \ref adiak_get_array.
+    */
    int is_reference;
    /** \brief Number of sub-elements for reference container values */
    int num_ref_elements;
@@ -235,7 +241,9 @@ typedef struct adiak_datatype_t {
  * adiak_ulonglong  | v_longlong (as unsigned long long)
  *
  * [*] Reference (zero-copy) container types store the original
- * input pointer in v_ptr.
+ * input pointer in v_ptr. Packed numeric lists and sets store a pointer
+ * to the packed array in v_ptr. Use \ref adiak_get_subval to read any of
+ * these.
  */
 typedef union adiak_value_t {
    signed long v_long;
@@ -272,6 +280,10 @@ static const adiak_datatype_t adiak_unset_datatype = { adiak_type_unset, adiak_n
  * This routine can safely be called multiple times. Subsequent calls have no
  * effect.
  *
+ * Mixing Adiak library versions in one process is not supported. Libraries
+ * built against different Adiak versions keep separate name/values, so
+ * tools registered through one may not see name/values set through another.
+ *
  * \param mpi_communicator_p Pointer to an MPI communicator, cast to void*. NULL
  *   if running without MPI.
  */
@@ -359,16 +371,69 @@ void adiak_fini();
  * \returns On success, returns 0. On a failure, returns -1.
  *
  * There is also a convenient C++ interface for registering values, see adiak::value.
+ *
+ * Name/value pairs can be set concurrently from multiple threads. Records are
+ * sharded by name, so threads setting different names rarely contend.
+ * \ref adiak_init, \ref adiak_fini, and \ref adiak_clean are not thread-safe.
  */
 int adiak_namevalue(const char *name, int category, const char *subcategory, const char *typestr, ...);
 
+/**
+ * \brief Register a name/value pair with Adiak, handing a malloc'd value over to Adiak.
+ *
+ * Like \ref adiak_namevalue, but instead of copying the value, Adiak takes
+ * ownership of the malloc'd string, \c struct \c timeval, or container
+ * buffer passed in the varargs, and frees it when the value is overwritten
+ * or \ref adiak_clean is called. The caller must not use or free the buffer
+ * after this call.
+ *
+ * Strings, and numeric lists and sets stored as packed arrays (see
+ * \ref adiak_datatype_t), are stored without a copy. Other containers are
+ * converted to Adiak's representation and the buffer is freed
+ * immediately. Adiak only takes ownership of the top-level buffer:
+ * strings or other objects referenced from a container are still copied.
+ *
+ * \code
+ * char *json = generate_json();
+ * adiak_namevalue_take("config", adiak_general, NULL, "%j", json);
+ *
+ * double *samples = (double *) malloc(n * sizeof(double));
+ * ...
+ * adiak_namevalue_take("samples", adiak_performance, NULL, "{%f}", samples, n);
+ * \endcode
+ *
+ * Reference types (\a &) can't be combined with ownership transfer.
+ *
+ * \returns On success, returns 0. If \a typestr is invalid or a reference
+ *   type, returns -1 and the caller keeps ownership of the buffer.
+ */
+int adiak_namevalue_take(const char *name, int category, const char *subcategory, const char *typestr, ...);
+
 /**
  * \brief Constructs a new adiak_datatype_t that can be passed to adiak_raw_namevalue.
  *
+ * Compound datatypes are cached by type string and element counts, so repeated
+ * calls with the same arguments return the same datatype. It remains valid until
+ * \ref adiak_clean is called.
+ *
  * \note It is not safe to free this datatype.
  */
 adiak_datatype_t *adiak_new_datatype(const char *typestr, ...);
 
+/**
+ * \brief Describe why the last type string on this thread failed to parse.
+ *
+ * Type strings are parsed by \ref adiak_namevalue, \ref adiak_new_datatype,
+ * and \ref adiak_get_handle. If the last type string parsed on the calling
+ * thread was malformed, this returns a short description of the problem,
+ * such as "expected '}'".
+ *
+ * \param[out] offset Character offset of the error in the type string. Can be NULL.
+ * \returns A static string describing the error, or NULL if the last type
+ *    string was parsed successfully.
+ */
+const char *adiak_get_typestr_error(int *offset);
+
 /**
  * \brief Register a new name/value pair with Adiak, but with an already constructed datatype
  *    and value.
@@ -376,6 +441,53 @@ adiak_datatype_t *adiak_new_datatype(const char *typestr, ...);
 int adiak_raw_namevalue(const char *name, int category, const char *subcategory,
                         adiak_value_t *value, adiak_datatype_t *type);
 
+/**
+ * \brief Opaque handle to a name/value record, see \ref adiak_get_handle.
+ */
+typedef struct adiak_name_handle_s *adiak_name_handle_t;
+
+/**
+ * \brief Get a handle for repeatedly updating the name/value pair \a name.
+ *
+ * The name, category, subcategory, and type string are resolved once when the
+ * handle is created. Updates through \ref adiak_update_handle then skip the
+ * name lookup and, for scalar and string types, the type string parsing.
+ * Tools are notified of each update exactly as with \ref adiak_namevalue.
+ *
+ * \code
+ * adiak_name_handle_t iter = adiak_get_handle("iteration", adiak_performance, NULL, "%d");
+ * for (int i = 0; i < n; ++i)
+ *    adiak_update_handle(iter, i);
+ * \endcode
+ *
+ * Handles are owned by Adiak and become invalid after \ref adiak_clean.
+ *
+ * \param name Name of the Adiak name/value pair.
+ * \param category Category of the name/value pair, see \ref adiak_namevalue.
+ * \param subcategory Optional subcategory string. Can be NULL.
+ * \param typestr Type string of the values, see \ref adiak_namevalue. Can be
+ *   NULL if the handle is only updated with \ref adiak_raw_update_handle.
+ * \returns The handle, or NULL if the type string is invalid or the handle
+ *    can't be allocated.
+ */
+adiak_name_handle_t adiak_get_handle(const char *name, int category, const char *subcategory, const char *typestr);
+
+/**
+ * \brief Update the name/value pair referenced by \a handle.
+ *
+ * \param handle Handle from \ref adiak_get_handle. It must have been created
+ *   with a type string.
+ * \param ... The new value, encoded as described by the handle's type string.
+ * \returns On success, returns 0. On a failure, returns -1.
+ */
+int adiak_update_handle(adiak_name_handle_t handle, ...);
+
+/**
+ * \brief Update the name/value pair referenced by \a handle with an already
+ *    constructed datatype and value, like \ref adiak_raw_namevalue.
+ */
+int adiak_raw_update_handle(adiak_name_handle_t handle, adiak_value_t *value, adiak_datatype_t *type);
+
 /** \brief Makes a 'adiakversion' name/val with the Adiak library version */
 int adiak_adiakversion();
 /** \brief Makes a 'user' name/val with the real name of who's running the job */
@@ -457,9 +569,65 @@ int adiak_mpi_library_version();
  */
 int adiak_collect_all();
 
-/** \brief Trigger a flush in registered tools. */
+/** \brief Trigger a flush in registered tools.
+ *
+ * Merges staged name/values first, see \ref adiak_sync. In async mode,
+ * waits until all queued name/values are reported, see
+ * \ref adiak_set_async_dispatch.
+ */
 int adiak_flush(const char *location);
 
+/** \brief Stage name/value updates in per-thread buffers.
+ *
+ * When enabled, \ref adiak_namevalue, \ref adiak_raw_namevalue, and handle
+ * updates append to a buffer owned by the calling thread instead of updating
+ * the shared record store. No locks or atomics are used on this path. Staged
+ * values are invisible to queries and tools until they are merged by
+ * \ref adiak_sync, \ref adiak_flush, or \ref adiak_fini.
+ *
+ * Disabling staging merges any staged values.
+ *
+ * \param enable 1 to enable staging, 0 to disable it.
+ */
+void adiak_set_thread_staging(int enable);
+
+/** \brief Merge staged name/values into the record store.
+ *
+ * If a name was staged more than once, the value with the latest timestamp
+ * wins; ties are broken by thread registration order. The surviving values
+ * are recorded and reported to tools in timestamp order.
+ *
+ * No thread may set name/values while this runs, except tool callbacks
+ * on the calling thread; what they stage is merged by the next call. The
+ * same holds for \ref adiak_flush and \ref adiak_fini.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+int adiak_sync();
+
+/** \brief Report name/values to tools on a background thread.
+ *
+ * When enabled, name/value updates are queued and tool callbacks are
+ * invoked by a dispatcher thread, so slow tools don't stall the
+ * application. Callbacks are still serialized and see updates in the order
+ * they were recorded. A queued value stays valid until its callbacks ran,
+ * even if the name is set again; memory passed by reference must stay
+ * valid until then, too. If the queue is full, setting a name/value waits,
+ * or, when called from a tool callback, delivers the queued updates itself.
+ *
+ * Control values are reported synchronously once the queue is drained, so
+ * \ref adiak_flush and \ref adiak_fini act as barriers. \ref adiak_fini
+ * and \ref adiak_clean also stop the dispatcher thread, as does disabling
+ * async dispatch.
+ *
+ * Don't call this concurrently with itself, \ref adiak_fini, or
+ * \ref adiak_clean.
+ *
+ * \param enable 1 to enable async dispatch, 0 to disable it.
+ * \return 0 on success, -1 if the dispatcher thread couldn't be started.
+ */
+int adiak_set_async_dispatch(int enable);
+
 /** \brief Clear all adiak name/values.
  *
  * This routine frees all heap memory used by adiak. This includes the cache of all
@@ -161,7 +161,7 @@ namespace adiak
     */
    template <typename T>
    bool value(std::string name, T value, int category = adiak_general, std::string subcategory = "") {
-      adiak_datatype_t *datatype = adiak::internal::parse<T>::make_type();
+      adiak_datatype_t *datatype = adiak::internal::make_value_type(value);
       if (!datatype)
          return false;
       adiak_value_t *avalue = (adiak_value_t *) malloc(sizeof(adiak_value_t));
@@ -175,7 +175,7 @@ namespace adiak
    bool value(std::string name, T valuea, T valueb,
               int category = adiak_general, std::string subcategory = "")
    {
-      adiak_datatype_t *datatype = adiak::internal::make_range_t<T>();
+      adiak_datatype_t *datatype = adiak::internal::make_range_type<T>();
       if (!datatype)
          return false;
       adiak_value_t *values = (adiak_value_t *) malloc(sizeof(adiak_value_t) * 2);
@@ -194,6 +194,94 @@ namespace adiak
       return true;
    }
 
+   /**
+    * \brief Register a numeric vector with Adiak as a packed list.
+    *
+    * Moving a vector of numbers into adiak::value stores it as one packed
+    * array at the elements' native width instead of one Adiak value per
+    * element, once a tool asked for packed arrays (see
+    * \ref adiak_datatype_t). The vector's storage can't be released to
+    * Adiak, so this makes a single flat copy, which is handed over with
+    * \ref adiak_namevalue_take. Vectors of other element types, such as
+    * std::vector<bool>, don't take this overload and are registered like
+    * any other container.
+    *
+    * \code
+    * std::vector<float> samples = compute_samples();
+    * adiak::value("samples", std::move(samples), adiak_performance);
+    * \endcode
+    *
+    * \sa adiak_namevalue_take
+    */
+   template <typename T,
+             typename std::enable_if<adiak::internal::packed_list<T>::value, int>::type = 0>
+   bool value(std::string name, std::vector<T>&& value,
+              int category = adiak_general, std::string subcategory = "")
+   {
+      const char *typestr = adiak::internal::packed_list<T>::typestr();
+      if (value.empty())
+         return adiak::value<std::vector<T> >(name, std::move(value), category, subcategory);
+      int count = (int) value.size();
+      void *buf = malloc(count * sizeof(T));
+      if (!buf)
+         return false;
+      memcpy(buf, value.data(), count * sizeof(T));
+      std::vector<T>().swap(value);
+      return adiak_namevalue_take(name.c_str(), category, subcategory.c_str(), typestr, buf, count) == 0;
+   }
+
+   /**
+    * \brief Register a string with Adiak, handing over a copy with
+    *    \ref adiak_namevalue_take.
+    */
+   inline bool value(std::string name, std::string&& value,
+                     int category = adiak_general, std::string subcategory = "")
+   {
+      char *buf = (char *) malloc(value.size() + 1);
+      if (!buf)
+         return false;
+      memcpy(buf, value.c_str(), value.size() + 1);
+      std::string().swap(value);
+      return adiak_namevalue_take(name.c_str(), category, subcategory.c_str(), "%s", buf) == 0;
+   }
+
+   /**
+    * \brief A handle for repeatedly updating the same name/value pair.
+    *
+    * The name is resolved once when the handle is created, so updates skip the
+    * name lookup. Tools are notified of each update as with adiak::value.
+    *
+    * \code
+    * adiak::handle<int> iteration("iteration", adiak_performance);
+    * for (int i = 0; i < n; ++i)
+    *    iteration.update(i);
+    * \endcode
+    *
+    * The handle becomes invalid after adiak_clean().
+    *
+    * \sa adiak_get_handle
+    */
+   template <typename T>
+   class handle {
+      adiak_name_handle_t m_handle;
+   public:
+      handle(const std::string& name, int category = adiak_general, const std::string& subcategory = "")
+         : m_handle(adiak_get_handle(name.c_str(), category, subcategory.c_str(), NULL))
+      { }
+
+      /// \brief Update the name/value pair with \a value
+      bool update(T value) {
+         adiak_datatype_t *datatype = adiak::internal::make_value_type(value);
+         if (!datatype)
+            return false;
+         adiak_value_t *avalue = (adiak_value_t *) malloc(sizeof(adiak_value_t));
+         bool result = adiak::internal::parse<T>::make_value(value, avalue, datatype);
+         if (!result)
+            return false;
+         return adiak_raw_update_handle(m_handle, avalue, datatype) == 0;
+      }
+   };
+
    /// \copydoc adiak_adiakversion
    inline bool adiakversion() {
       return adiak_adiakversion() == 0;
@@ -22,6 +22,9 @@
 
 extern "C" {
    adiak_datatype_t *adiak_get_basetype(adiak_type_t t);
+   adiak_datatype_t *adiak_get_compound_type(adiak_type_t dtype, int num_elements, int num_subtypes,
+                                             adiak_datatype_t **subtypes);
+   const char *adiak_intern_string(const char *str);
 }
 
 namespace adiak
@@ -111,11 +114,11 @@ namespace adiak
       };
       template<> struct element_type<adiak::path> {
          static const adiak_type_t dtype = adiak_path;
-         static void set(adiak_value_t &v, adiak::path p) { v.v_ptr = strdup(p.v.c_str()); }
+         static void set(adiak_value_t &v, adiak::path p) { v.v_ptr = (void *) adiak_intern_string(p.v.c_str()); }
       };
       template<> struct element_type<adiak::catstring> {
          static const adiak_type_t dtype = adiak_catstring;
-         static void set(adiak_value_t &v, adiak::catstring p) { v.v_ptr = strdup(p.v.c_str()); }
+         static void set(adiak_value_t &v, adiak::catstring p) { v.v_ptr = (void *) adiak_intern_string(p.v.c_str()); }
       };
       template<> struct element_type<adiak::jsonstring> {
          static const adiak_type_t dtype = adiak_jsonstring;
@@ -216,7 +219,8 @@ namespace adiak
                   return false;
             }
             element_type<T>::set(*value, valarray);
-            dtype->num_elements = c.size();
+            if (dtype->num_elements != (int) c.size())
+               dtype->num_elements = c.size();
             return true;
          }
       };
@@ -326,6 +330,124 @@ namespace adiak
             return true;
          }
       };
+
+      // Compile-time datatype descriptors. The datatypes of scalars, tuples of
+      // scalars, and containers of those are shared, immutable Adiak datatypes
+      // that only differ in the element count, so creating them needs no
+      // allocation. Nested containers have per-element counts and are built
+      // with parse<T>::make_type() instead.
+
+      template <typename T, adiak_type_t D = element_type<T>::dtype>
+      struct static_type {
+         static const bool is_static = (D != adiak_type_unset);
+         /// true if the datatype doesn't depend on the value
+         static const bool is_element = is_static;
+         static adiak_datatype_t *element() { return adiak_get_basetype(D); }
+         static adiak_datatype_t *get(const T &) { return element(); }
+      };
+
+      template <typename... Ts>
+      struct all_static_elements {
+         static const bool value = true;
+      };
+      template <typename T, typename... Ts>
+      struct all_static_elements<T, Ts...> {
+         static const bool value = static_type<T>::is_element && all_static_elements<Ts...>::value;
+      };
+
+      template <typename T, adiak_type_t D>
+      struct static_container_type {
+         typedef typename T::value_type U;
+         static const bool is_static = static_type<U>::is_element;
+         static const bool is_element = false;
+         static adiak_datatype_t *get(const T &c) {
+            adiak_datatype_t *subtype = static_type<U>::element();
+            if (!subtype)
+               return NULL;
+            return adiak_get_compound_type(D, (int) c.size(), 1, &subtype);
+         }
+      };
+
+      template <typename T>
+      struct static_type<T, adiak_set> : public static_container_type<T, adiak_set> { };
+      template <typename T>
+      struct static_type<T, adiak_list> : public static_container_type<T, adiak_list> { };
+
+      template <typename... Ts>
+      struct static_type<std::tuple<Ts...>, adiak_tuple> {
+         static const bool is_static = sizeof...(Ts) > 0 && all_static_elements<Ts...>::value;
+         static const bool is_element = is_static;
+         static adiak_datatype_t *element() {
+            const int N = sizeof...(Ts);
+            adiak_datatype_t *subtypes[N + 1] = { static_type<Ts>::element()..., NULL };
+            for (int i = 0; i < N; ++i)
+               if (!subtypes[i])
+                  return NULL;
+            return adiak_get_compound_type(adiak_tuple, N, N, subtypes);
+         }
+         static adiak_datatype_t *get(const std::tuple<Ts...> &) { return element(); }
+      };
+
+      template <typename T>
+      adiak_datatype_t *make_value_type(const T &, std::false_type) {
+         return parse<T>::make_type();
+      }
+      template <typename T>
+      adiak_datatype_t *make_value_type(const T &value, std::true_type) {
+         adiak_datatype_t *datatype = static_type<T>::get(value);
+         return datatype ? datatype : parse<T>::make_type();
+      }
+
+      /// \brief Return the datatype for \a value, shared if possible
+      template <typename T>
+      adiak_datatype_t *make_value_type(const T &value) {
+         return make_value_type(value, std::integral_constant<bool, static_type<T>::is_static>());
+      }
+
+      template <typename T>
+      adiak_datatype_t *make_range_type(std::false_type) {
+         return make_range_t<T>();
+      }
+      template <typename T>
+      adiak_datatype_t *make_range_type(std::true_type) {
+         adiak_datatype_t *subtype = static_type<T>::element();
+         adiak_datatype_t *datatype = subtype ? adiak_get_compound_type(adiak_range, 2, 1, &subtype) : NULL;
+         return datatype ? datatype : make_range_t<T>();
+      }
+
+      /// \brief Return the datatype for a range of \a T, shared if possible
+      template <typename T>
+      adiak_datatype_t *make_range_type() {
+         return make_range_type<T>(std::integral_constant<bool, static_type<T>::is_element>());
+      }
+
+      // Type string of a numeric list that Adiak stores packed, for handing
+      // over element arrays with adiak_namevalue_take. value is false and
+      // typestr() is NULL if T is not a numeric scalar.
+
+      template<typename T> struct packed_list {
+         static const bool value = false;
+         static const char *typestr() { return NULL; }
+      };
+#define ADIAK_PACKED_LIST(T, str) \
+      template<> struct packed_list<T> { \
+         static const bool value = true; \
+         static const char *typestr() { return str; } \
+      };
+      ADIAK_PACKED_LIST(long, "{%ld}")
+      ADIAK_PACKED_LIST(unsigned long, "{%lu}")
+      ADIAK_PACKED_LIST(long long, "{%lld}")
+      ADIAK_PACKED_LIST(unsigned long long, "{%llu}")
+      ADIAK_PACKED_LIST(int, "{%d}")
+      ADIAK_PACKED_LIST(unsigned int, "{%u}")
+      ADIAK_PACKED_LIST(short, "{%i16}")
+      ADIAK_PACKED_LIST(unsigned short, "{%u16}")
+      ADIAK_PACKED_LIST(char, std::is_signed<char>::value ? "{%i8}" : "{%u8}")
+      ADIAK_PACKED_LIST(signed char, "{%i8}")
+      ADIAK_PACKED_LIST(unsigned char, "{%u8}")
+      ADIAK_PACKED_LIST(double, "{%f}")
+      ADIAK_PACKED_LIST(float, "{%f32}")
+#undef ADIAK_PACKED_LIST
    }
 }
 
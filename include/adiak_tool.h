@@ -54,6 +54,11 @@ typedef struct adiak_record_info_t {
  * \param t The datatype specification of the name/value pair.
  * \param opaque_value Optional user-defined pass-through argument
  *
+ * Adiak shares datatypes between name/value pairs: structurally equal compound
+ * datatypes, including their element counts, are usually the same object, so
+ * tools can use the datatype pointer as a key for per-type data. Datatypes
+ * remain valid until \ref adiak_clean is called.
+ *
  * \sa adiak_register_cb, adiak_list_namevals
  */
 typedef void (*adiak_nameval_cb_t)(const char *name, int category, const char *subcategory, adiak_value_t *value, adiak_datatype_t *t, void *opaque_value);
@@ -78,7 +83,8 @@ typedef void (*adiak_nameval_info_cb_t)(const char *name, adiak_value_t *value,
 /**
  * \brief Register a callback function to be invoked when a name/value pair is set
  *
- * \param[in] adiak_version Adiak API version. Currently 1.
+ * \param[in] adiak_version Adiak API version. Currently 2. With 1, packed
+ *   arrays are reported unpacked, see \ref adiak_get_array.
  * \param[in] category The Adiak category (e.g., \ref adiak_general) to capture.
  *   Callbacks will only be invoked for name/values of \a category. Can be
  *   \ref adiak_category_all to capture all name/value pairs.
@@ -86,6 +92,12 @@ typedef void (*adiak_nameval_info_cb_t)(const char *name, adiak_value_t *value,
  * \param[in] report_on_all_ranks If set to 0, reports only on the root rank in an MPI program.
  *   Otherwise reports on all ranks.
  * \param[in] opaque_val User-provided value passed through to the callback function.
+ *
+ * Name/values may be set from multiple threads. Adiak serializes all tool
+ * callbacks, including those from \ref adiak_list_namevals, so callbacks
+ * need not be thread-safe. Callbacks may query and set name/values. If
+ * threads set the same name at the same time, the callback may only see
+ * the value set last.
  */
 void adiak_register_cb(int adiak_version, int category, adiak_nameval_cb_t nv, int report_on_all_ranks, void *opaque_val);
 
@@ -94,13 +106,108 @@ void adiak_register_cb(int adiak_version, int category, adiak_nameval_cb_t nv, i
  */
 void adiak_register_cb_with_info(int adiak_version, int category, adiak_nameval_info_cb_t nv, int report_on_all_ranks, void *opaque_val);
 
+/**
+ * \brief Register a callback function for selected name/value pairs
+ *
+ * Like \ref adiak_register_cb, but the callback is only invoked for
+ * name/value pairs that match \a names and \a subcategories. The filter is
+ * compiled once at registration; name/values that don't match are skipped
+ * without calling into the tool. Control values like \c flush and \c fini
+ * are not filtered.
+ *
+ * \param[in] adiak_version Adiak API version. Currently 2. With 1, packed
+ *   arrays are reported unpacked, see \ref adiak_get_array.
+ * \param[in] category The Adiak category (e.g., \ref adiak_general) to capture.
+ *   Can be \ref adiak_category_all to capture all name/value pairs.
+ * \param[in] names Comma-separated list of name patterns, or NULL for all
+ *   names. A pattern is a name, a prefix like \c "mpi_*", or a glob with
+ *   \c * and \c ? wildcards.
+ * \param[in] subcategories Comma-separated list of subcategories, or NULL
+ *   for all subcategories. If given, name/values without subcategory don't
+ *   match.
+ * \param[in] nv User-provided callback function
+ * \param[in] report_on_all_ranks If set to 0, reports only on the root rank in an MPI program.
+ *   Otherwise reports on all ranks.
+ * \param[in] opaque_val User-provided value passed through to the callback function.
+ */
+void adiak_register_cb_filtered(int adiak_version, int category, const char *names, const char *subcategories,
+                                adiak_nameval_cb_t nv, int report_on_all_ranks, void *opaque_val);
+
+/**
+ * \copydoc adiak_register_cb_filtered
+ */
+void adiak_register_cb_with_info_filtered(int adiak_version, int category, const char *names,
+                                          const char *subcategories, adiak_nameval_info_cb_t nv,
+                                          int report_on_all_ranks, void *opaque_val);
+
+/**
+ * \brief A name/value pair delivered to a batch callback
+ *
+ * \sa adiak_batch_cb_t
+ */
+typedef struct adiak_batch_entry_t {
+    /** \brief Name of the name/value pair */
+    const char* name;
+    /** \brief The datatype of the name/value pair */
+    adiak_datatype_t* type;
+    /** \brief The value of the name/value pair */
+    adiak_value_t* value;
+    /** \brief Category, subcategory, and timestamp of the name/value pair */
+    adiak_record_info_t* info;
+} adiak_batch_entry_t;
+
+/**
+ * \brief Callback function for processing a batch of Adiak name/value pairs
+ *
+ * \param entries The name/value pairs, in the order they were first set
+ *   since the previous batch
+ * \param num_entries Number of entries
+ * \param opaque_value Optional user-defined pass-through argument
+ *
+ * The entries, and the values they point to, are only valid during the
+ * callback.
+ *
+ * \sa adiak_register_batch_cb
+ */
+typedef void (*adiak_batch_cb_t)(adiak_batch_entry_t *entries, int num_entries, void *opaque_value);
+
+/**
+ * \brief Register a callback function that receives name/value updates in batches
+ *
+ * Instead of one callback per update, the tool receives the names set since
+ * the previous batch. A name set more than once appears once, with its
+ * latest value. A batch is delivered when \a batch_size names are pending,
+ * and whenever a control value is set, e.g. by \ref adiak_flush or
+ * \ref adiak_fini. If the tool receives control values, e.g. with
+ * \ref adiak_category_all, the control value is the last entry of the
+ * batch it triggers. Otherwise control values only deliver pending names.
+ *
+ * While the batch callback runs, Adiak holds the lock that serializes tool
+ * callbacks, so that the entries stay valid.
+ *
+ * \param[in] adiak_version Adiak API version. Currently 2. With 1, packed
+ *   arrays are reported unpacked, see \ref adiak_get_array.
+ * \param[in] category The Adiak category (e.g., \ref adiak_general) to capture.
+ *   Can be \ref adiak_category_all to capture all name/value pairs.
+ * \param[in] cb User-provided batch callback function
+ * \param[in] batch_size Number of pending names that triggers a batch, or
+ *   0 to only deliver batches on control values.
+ * \param[in] report_on_all_ranks If set to 0, reports only on the root rank in an MPI program.
+ *   Otherwise reports on all ranks.
+ * \param[in] opaque_val User-provided value passed through to the callback function.
+ */
+void adiak_register_batch_cb(int adiak_version, int category, adiak_batch_cb_t cb, int batch_size,
+                             int report_on_all_ranks, void *opaque_val);
+
 /**
  * \brief Iterate over the name/value pairs currently registered with Adiak
  *
  * Iterates over all currently set name/value pairs of \a category and invokes the callback
- * function \a nv for each name/value pair.
+ * function \a nv for each name/value pair, in the order the names were first set.
+ * Listing a single category only visits the name/value pairs in that category.
  *
- * \param[in] adiak_version Adiak API version. Currently 1.
+ * \param[in] adiak_version Adiak API version. Currently 2. With 1, packed
+ *   arrays are reported unpacked, see \ref adiak_get_array.
  * \param[in] category The Adiak category (e.g., \ref adiak_general) to capture.
  *   Callbacks will only be invoked for name/values of \a category. Can be
  *   \ref adiak_category_all to capture all name/value pairs.
@@ -114,6 +221,55 @@ void adiak_list_namevals(int adiak_version, int category, adiak_nameval_cb_t nv,
  */
 void adiak_list_namevals_with_info(int adiak_version, int category, adiak_nameval_info_cb_t nv, void *opaque_val);
 
+/**
+ * \brief Iterate over the name/value pairs set after a given generation
+ *
+ * Every update of a name/value pair gets a new, increasing generation
+ * number. This function invokes \a nv once for each name/value pair of
+ * \a category that was set after \a generation, in the order of their
+ * latest update, and returns the current generation. Passing that to the
+ * next call lists only what changed in between:
+ *
+ * \code
+ * unsigned long long gen = 0;
+ * gen = adiak_list_namevals_since(2, adiak_category_all, gen, write_record, NULL);
+ * // ... later, only new and updated name/values
+ * gen = adiak_list_namevals_since(2, adiak_category_all, gen, write_record, NULL);
+ * \endcode
+ *
+ * The changes are read from a change log, so the cost depends on the number
+ * of changes rather than the number of name/value pairs. A name/value pair
+ * set again while this runs may be listed again by the next call.
+ * Name/values set through an older Adiak library in the same process have
+ * no generations and are not listed, see \ref adiak_init.
+ *
+ * \param[in] adiak_version Adiak API version. Currently 2. With 1, packed
+ *   arrays are reported unpacked, see \ref adiak_get_array.
+ * \param[in] category The Adiak category (e.g., \ref adiak_general) to capture,
+ *   or \ref adiak_category_all.
+ * \param[in] generation List name/values set after this generation; 0 lists all.
+ * \param[in] nv Pointer to the user-provided callback function.
+ * \param[in] opaque_val User-provided value passed through to the callback function.
+ * \return The current generation.
+ */
+unsigned long long adiak_list_namevals_since(int adiak_version, int category, unsigned long long generation,
+                                             adiak_nameval_cb_t nv, void *opaque_val);
+
+/**
+ * \copydoc adiak_list_namevals_since
+ */
+unsigned long long adiak_list_namevals_since_with_info(int adiak_version, int category,
+                                                       unsigned long long generation,
+                                                       adiak_nameval_info_cb_t nv, void *opaque_val);
+
+/**
+ * \brief Return the number of name/value pairs in \a category
+ *
+ * \param[in] category The Adiak category (e.g., \ref adiak_general), or
+ *   \ref adiak_category_all to count all name/value pairs.
+ */
+int adiak_count_namevals(int category);
+
 /**
  * \brief Return the type string descriptor for an Adiak datatype specification
  *
@@ -134,6 +290,8 @@ char *adiak_type_to_string(adiak_datatype_t *t, int long_form);
  * \param[out] value Value of the name/value pair
  * \param[out] category The Adiak category, e.g. \ref adiak_general
  * \param[out] subcat Optional user-defined sub-category. Can be NULL.
+ *
+ * The value may be a packed numeric array, see \ref adiak_get_array.
  */
 int adiak_get_nameval(const char *name, adiak_datatype_t **t, adiak_value_t **value, int *category, const char **subcat);
 
@@ -147,6 +305,85 @@ int adiak_get_nameval(const char *name, adiak_datatype_t **t, adiak_value_t **va
  */
 int adiak_get_nameval_with_info(const char* name, adiak_datatype_t **t, adiak_value_t **value, adiak_record_info_t **info);
 
+/**
+ * \brief Return the interned copy of \a str
+ *
+ * Adiak interns record names, subcategories, and the values of
+ * \ref adiak_catstring and \ref adiak_path name/value pairs: identical strings
+ * share one copy. The name and subcategory pointers passed to tool callbacks
+ * are interned, so tools can compare them against an interned string by pointer
+ * instead of using strcmp.
+ *
+ * The returned string is owned by Adiak and remains valid until
+ * \ref adiak_clean is called.
+ *
+ * \param[in] str The string to intern
+ * \return The interned copy of \a str, or NULL if \a str is NULL.
+ */
+const char *adiak_intern_string(const char *str);
+
+/**
+ * \brief Return statistics about Adiak's interned string pool
+ *
+ * \param[out] num_strings Number of distinct strings in the pool. Can be NULL.
+ * \param[out] bytes_used Bytes used by the distinct strings. Can be NULL.
+ * \param[out] bytes_saved Bytes saved by sharing repeated strings instead of
+ *   copying them. Can be NULL.
+ */
+void adiak_get_string_pool_stats(size_t *num_strings, size_t *bytes_used, size_t *bytes_saved);
+
+/**
+ * \brief One node of the flattened form of a datatype
+ *
+ * A flattened datatype is an array of nodes in pre-order: a node is followed
+ * by the nodes of its subtypes, so the subtree of node \a i occupies
+ * indices \a i to \a i + \a subtree_size - 1 and its first subtype, if any, is
+ * at \a i + 1.
+ *
+ * \sa adiak_get_flat_type, adiak_flat_subtype
+ */
+typedef struct adiak_flat_type_t {
+    /** \brief Type descriptor */
+    adiak_type_t dtype;
+    /** \brief Number of sub-elements: num_elements + num_ref_elements of \a type */
+    int num_elements;
+    /** \brief 1 if this a reference (i.e., zero-copy) entry, 2 if it is a
+     *  packed numeric array (see \ref adiak_get_array), 0 if not */
+    int is_reference;
+    /** \brief Number of subtypes */
+    int num_subtypes;
+    /** \brief Number of nodes in this node's subtree, including the node itself */
+    int subtree_size;
+    /** \brief The datatype this node describes */
+    adiak_datatype_t *type;
+} adiak_flat_type_t;
+
+/**
+ * \brief Return the flattened form of datatype \a t
+ *
+ * Adiak keeps a flattened copy of each shared datatype in a single
+ * allocation, so walking nested datatypes through it touches contiguous
+ * memory. Node 0 describes \a t itself. The returned array is owned by Adiak
+ * and remains valid until \ref adiak_clean is called.
+ *
+ * \param[in] t The datatype
+ * \param[out] num_nodes Number of nodes in the returned array. Can be NULL.
+ * \return The flattened datatype, or NULL if \a t is not a datatype shared by
+ *   Adiak, e.g. if it was created by an older Adiak version. Use the
+ *   \a subtype pointers of \a t in that case.
+ */
+const adiak_flat_type_t *adiak_get_flat_type(adiak_datatype_t *t, int *num_nodes);
+
+/**
+ * \brief Return the index of the \a n th subtype of flattened node \a node
+ *
+ * \param[in] flat A flattened datatype from \ref adiak_get_flat_type
+ * \param[in] node Index of the parent node in \a flat
+ * \param[in] n Subtype number, from 0 to the parent's num_subtypes - 1
+ * \return Index of the subtype node in \a flat, or -1 if \a n is out of range.
+ */
+int adiak_flat_subtype(const adiak_flat_type_t *flat, int node, int n);
+
 /**
  * \brief Return the number of sub-values for the given container type \a t
  */
@@ -162,7 +399,7 @@ int adiak_num_subvals(adiak_datatype_t* t);
  * This function works for both Adiak-created deep copies (where values
  * are stored as individual \a adiak_value_t entries in \a val->v_subvals)
  * and reference entries (where the original pointer is stored as
- * \a val->v_ptr).
+ * \a val->v_ptr), including packed numeric arrays.
  *
  * Returns NULL in \a subtype and in \a subvalue.v_ptr if the given
  * value is not a container type or \a elem is out-of-bounds.
@@ -174,6 +411,67 @@ int adiak_num_subvals(adiak_datatype_t* t);
  * \param[out] subval Returns the selected sub-value
  */
 int adiak_get_subval(adiak_datatype_t* t, adiak_value_t* val, int elem, adiak_datatype_t** subtype, adiak_value_t* subval);
+
+/**
+ * \brief Return a pointer to the packed elements of a numeric container value
+ *
+ * Adiak copies numeric lists and sets into packed arrays at the elements'
+ * native width, e.g. 4 bytes per element for "{%f32}". Numeric reference
+ * containers are packed arrays as well. This function gives direct access
+ * to the array, so tools can process it in bulk instead of element by
+ * element through \ref adiak_get_subval.
+ *
+ * Packed copies have \a is_reference set to 2, which tools written for
+ * adiak_version 1 don't know. Adiak therefore only packs copies once a tool
+ * registered with adiak_version 2; values set before stay unpacked. Tools
+ * registered with adiak_version 1, and listings with it, get an unpacked
+ * copy instead, with one adiak_value_t per element.
+ *
+ * The element width is the \a num_bytes of \a elem_type for \ref adiak_int,
+ * \ref adiak_uint and \ref adiak_double elements, and sizeof(long) or
+ * sizeof(long long) for the other numeric types.
+ *
+ * \param[in] t The container datatype
+ * \param[in] val The container value
+ * \param[out] ptr Returns a pointer to the first element. Can be NULL.
+ * \param[out] count Returns the number of elements. Can be NULL.
+ * \param[out] elem_type Returns the element datatype. Can be NULL.
+ * \return 0 on success, -1 if \a val is not a packed numeric container.
+ */
+int adiak_get_array(adiak_datatype_t *t, adiak_value_t *val, void **ptr, int *count, adiak_datatype_t **elem_type);
+
+/**
+ * \brief Callback function for \ref adiak_foreach_subval
+ *
+ * \param index Index of the sub-value in the container
+ * \param subtype Datatype of the sub-value
+ * \param subval The sub-value. Only valid during the callback.
+ * \param opaque_value User-defined pass-through argument
+ * \return 0 to continue the iteration, or a non-zero value to stop it.
+ */
+typedef int (*adiak_subval_cb_t)(int index, adiak_datatype_t *subtype, adiak_value_t *subval, void *opaque_value);
+
+/**
+ * \brief Invoke \a cb for each sub-value of a container value, in order
+ *
+ * Decodes the container in one pass, like calling \ref adiak_get_subval for
+ * each index from 0 to \ref adiak_num_subvals - 1, but without locating each
+ * element from scratch. Works for Adiak-created copies, reference entries,
+ * and packed numeric arrays.
+ *
+ * Sub-values that are containers themselves can be passed to
+ * \ref adiak_foreach_subval again from within the callback to visit nested
+ * containers.
+ *
+ * \param[in] t The container datatype
+ * \param[in] val The container value
+ * \param[in] cb Callback function invoked for each sub-value
+ * \param[in] opaque_value User-defined value passed through to \a cb
+ * \return 0 if all sub-values were visited, the non-zero value returned
+ *   by \a cb if it stopped the iteration, or -1 if \a t is not a
+ *   container type or a sub-value can't be decoded.
+ */
+int adiak_foreach_subval(adiak_datatype_t *t, adiak_value_t *val, adiak_subval_cb_t cb, void *opaque_value);
 /**
  * \}
  * \}
@@ -28,6 +28,11 @@ typedef struct adiak_tool_t {
    int category;
    // Below fields are present with record info
    adiak_nameval_info_cb_t nameval_info_cb;
+   // Below fields are present with TOOL_EXTENDED_LAYOUT
+   adiak_batch_cb_t batch_cb;
+   int batch_size;
+   struct tool_batch_t *batch;
+   struct tool_filter_t *filter;
 } adiak_tool_t;
 
 typedef struct record_list_t {
@@ -37,10 +42,452 @@ typedef struct record_list_t {
    adiak_value_t *value;
    adiak_datatype_t *dtype;
    struct record_list_t *list_next;
-   struct record_list_t *hash_next;
+   struct record_list_t *hash_next; /* only used by v1 record hashes */
    adiak_record_info_t *info;
+   // Below fields are only present in record table records
+   adiak_value_t embedded; /* top-level value storage, value points here */
 } record_list_t;
 
+/* Names pending delivery to a batch tool, in the order they were first set
+   since the last batch. pending has a bit per record table position.
+   Batches are only touched while delivering tool callbacks, i.e. by a tool
+   lock holder or the async dispatcher.
+ */
+typedef struct tool_batch_t {
+   record_list_t **records;
+   int count;
+   int capacity;
+   unsigned char *pending;
+   size_t pending_bytes;
+   adiak_batch_entry_t *entries;
+   int entries_capacity;
+   int delivering;
+} tool_batch_t;
+
+/* A tool's name and subcategory filter, compiled from comma-separated
+   lists at registration. Names without wildcards and subcategories are
+   interned, so record names and subcategories match by pointer.
+   Patterns that end in their only '*' match by prefix; other patterns are
+   globs. An empty list matches everything.
+ */
+#define NAME_PATTERN_EXACT 0
+#define NAME_PATTERN_PREFIX 1
+#define NAME_PATTERN_GLOB 2
+
+typedef struct {
+   int kind;
+   size_t len;
+   const char *pattern;
+} name_pattern_t;
+
+typedef struct tool_filter_t {
+   name_pattern_t *names;
+   int num_names;
+   const char **subcategories;
+   int num_subcategories;
+   char *patterns; /* the name list, split in place */
+} tool_filter_t;
+
+typedef struct {
+   uint64_t hash;
+   record_list_t *record;
+} record_index_entry_t;
+
+/* Open-addressing (linear probing) name -> record index. The capacity is
+   always a power of two and doubles whenever the load factor exceeds
+   RECORD_INDEX_MAX_LOAD percent. Records are never removed individually,
+   so no tombstones are needed.
+ */
+typedef struct {
+   record_index_entry_t *entries;
+   size_t capacity;
+   size_t count;
+} record_index_t;
+
+#define RECORD_INDEX_MIN_CAPACITY 64
+#define RECORD_INDEX_MAX_LOAD 70
+
+/* Chunked bump allocator. Allocations cannot be freed individually; all
+   chunks are released at once by arena_free_all().
+ */
+typedef struct arena_chunk_t {
+   struct arena_chunk_t *next;
+   size_t size;
+   size_t used;
+} arena_chunk_t;
+
+typedef struct {
+   arena_chunk_t *head;
+   size_t next_chunk_size;
+} adiak_arena_t;
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_CHUNK_SIZE 4096
+#define ARENA_MAX_CHUNK_SIZE (1024*1024)
+#define ARENA_ROUND_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+/* Interned strings. Identical strings share one copy in the pool's arena,
+   so interned strings can be compared by pointer.
+ */
+typedef struct {
+   uint64_t hash;
+   const char *str;
+} string_pool_entry_t;
+
+typedef struct {
+   string_pool_entry_t *entries;
+   size_t capacity;
+   size_t count;
+   size_t bytes_used;
+   size_t bytes_saved;
+   adiak_arena_t arena;
+} string_pool_t;
+
+/* Records and their infos are stored in insertion order in a segmented
+   table. Segment k holds RECORD_TABLE_FIRST_SEGMENT << k slots, so records
+   never move and iteration walks memory linearly. A slot is reserved
+   atomically; its record becomes visible to iteration once its name is
+   set.
+ */
+typedef struct {
+   record_list_t record; /* must be first, see record_position */
+   adiak_record_info_t info;
+   size_t position;
+   uint64_t generation; /* of the latest update, see change_log_t */
+} record_slot_t;
+
+#define RECORD_TABLE_FIRST_SEGMENT 64
+#define RECORD_TABLE_SEGMENTS 32
+
+typedef struct {
+   record_slot_t *segments[RECORD_TABLE_SEGMENTS];
+   size_t count;
+} record_table_t;
+
+/* Secondary index from category to the table positions of its records,
+   kept in ascending (insertion) order. An open-addressing map keyed by
+   category; entries are never removed.
+ */
+typedef struct {
+   int category;
+   int used;
+   size_t *positions;
+   size_t count;
+   size_t capacity;
+} category_entry_t;
+
+#define CATEGORY_INDEX_MIN_CAPACITY 16
+
+/* Cache of parsed compound datatypes, keyed by type string and element
+   counts. Cached datatypes are shared and immutable and live until
+   adiak_clean. The cache also keeps the set of cached datatypes, to tell
+   them from datatypes built elsewhere, see is_shared_type.
+
+   Entries without a type string hash-cons datatype nodes: they are keyed
+   by the node's fields and subtype pointers, so structurally equal
+   datatypes share one node. Each owns its node, but not the subtypes,
+   which are base types or other entries. Type string entries point to
+   these nodes.
+ */
+#define TYPE_CACHE_MAX_COUNTS 16
+#define TYPE_CACHE_MAX_ENTRIES 4096
+#define TYPE_CACHE_MIN_CAPACITY 64
+
+typedef struct {
+   uint64_t hash;
+   const char *typestr;
+   int num_counts;
+   int counts[TYPE_CACHE_MAX_COUNTS];
+   adiak_datatype_t **subtypes;
+   adiak_datatype_t *type;
+} type_cache_entry_t;
+
+/* A shared (hash-consed) datatype node. Canonical datatype pointers point
+   to type. The subtype array, the flattened form of the datatype, and for
+   tuples the element offsets follow in the same allocation. size, stride
+   and offsets describe the input (and zero-copy) layout; they are -1 if a
+   subtype has no fixed size.
+
+   Datatypes that can't be cached, e.g. when the cache is full, are private
+   nodes with is_shared 0, a separately allocated subtype array, and no
+   other fields set. They are freed with their values. is_shared must stay
+   right after type, see is_shared_type.
+ */
+typedef struct {
+   adiak_datatype_t type;
+   int is_shared;
+   int num_flat;
+   adiak_flat_type_t *flat;
+   int size;     /* calc_size of type */
+   int stride;   /* element size of non-tuple containers */
+   int *offsets; /* element offsets of tuples, NULL otherwise */
+} shared_type_t;
+
+/* State of the type string parser. The parser reads the type string in one
+   left-to-right pass, taking container element counts from ap as it goes.
+   Without build it only reads the counts, e.g. to look up the type cache.
+ */
+typedef struct {
+   const char *str;
+   int pos;
+   va_list *ap;
+   int build;
+   int *counts;
+   int num_counts;
+   int max_counts;
+   const char *error;
+   int error_pos;
+} typestr_parser_t;
+
+/* Set of the single-allocation blocks that hold deep-copied container
+   values, so that free can tell them apart from values built element by
+   element (e.g., by the C++ interface or older Adiak versions). Sharded by
+   pointer hash; removed pointers leave tombstones.
+ */
+#define VALUE_BLOCK_SHARDS 16
+#define VALUE_BLOCK_MIN_CAPACITY 64
+
+/* is_reference value of packed numeric lists and sets: a value block with
+   the elements at their native width, in the zero-copy layout.
+ */
+#define PACKED_REFERENCE 2
+
+/* Values are only packed once a tool registered with this adiak_version.
+   Tools and listings with an older version get an unpacked copy, with one
+   adiak_value_t per element, see unpack_value.
+ */
+#define PACKED_VALUES_VERSION 2
+
+/* Set in the version of tools registered by this library, which have the
+   fields past nameval_info_cb. Tools registered by older library copies
+   end at nameval_info_cb, and their version is the one the tool passed.
+ */
+#define TOOL_EXTENDED_LAYOUT 0x40000000
+
+typedef struct {
+   adiak_datatype_t *type; /* NULL until unpacked */
+   adiak_value_t value;
+} unpacked_value_t;
+
+typedef struct {
+   void **slots;
+   size_t capacity;
+   size_t count;
+   size_t used; /* count plus tombstones */
+} value_block_set_t;
+
+/* A recursive spin lock. A zero-initialized lock is unlocked, so locks can
+   live in the statically initialized record store. The owner is
+   identified by the address of a thread-local variable.
+ */
+typedef struct {
+   void *owner;
+   int count;
+} adiak_lock_t;
+
+#define LOCK_SPINS_BEFORE_YIELD 64
+
+/* Record metadata is sharded by name hash so that threads registering
+   different names rarely contend. Each record shard has a name index into
+   the record table, and an arena for handles. Each string
+   shard has a pool for names, subcategories and categorical string values.
+
+   Lock order: the tool lock (see acquire_tool_lock), then a record shard
+   lock, then a string shard lock, the category index lock, the type cache
+   lock, a value block shard lock, or the retired value lock. Nothing else
+   is acquired while one of these is held. Only a batch delivery holds
+   several record shard locks, taken in shard order under the tool lock.
+ */
+#define RECORD_SHARDS 64
+#define STRING_SHARDS 16
+#define SHARD_OF(hash, n) ((size_t) ((hash) >> 40) & ((n) - 1))
+
+/* Record updates in generation order, for adiak_list_namevals_since. Each
+   update takes the next generation from the store's counter and appends it
+   with the record's table position to its shard's log, so generations
+   increase along each log. An entry is stale once its record has a newer
+   generation; stale entries are dropped when the log is full, before it
+   grows. If the log can't grow, it is marked incomplete and listings fall
+   back to scanning the record table. Protected by the shard lock.
+ */
+#define CHANGE_LOG_MIN_CAPACITY 64
+
+typedef struct {
+   uint64_t generation;
+   size_t position;
+} change_entry_t;
+
+typedef struct {
+   change_entry_t *entries;
+   size_t count;
+   size_t capacity;
+   int incomplete;
+} change_log_t;
+
+typedef struct {
+   adiak_lock_t lock;
+   record_index_t index;
+   adiak_arena_t arena;
+   change_log_t changes;
+} record_shard_t;
+
+typedef struct {
+   adiak_lock_t lock;
+   string_pool_t pool;
+} string_shard_t;
+
+/* Per-thread staging buffers for adiak_set_thread_staging mode. Each
+   buffer is only written by its owning thread and read by adiak_sync, so
+   appending needs no atomics. Strings are stored as offsets into the
+   buffer's string storage, which may be reallocated. Buffers stay on the
+   store's list after their thread exits, until adiak_clean frees them.
+ */
+#define STAGED_NO_STRING ((size_t) -1)
+
+typedef struct {
+   size_t name;
+   size_t subcategory;
+   int category;
+   adiak_value_t value;
+   adiak_datatype_t *dtype;
+   struct timespec timestamp;
+} staged_entry_t;
+
+typedef struct staging_buffer_t {
+   struct staging_buffer_t *next;
+   int id; /* registration order, breaks timestamp ties */
+   staged_entry_t *entries;
+   size_t count;
+   size_t capacity;
+   char *strings;
+   size_t strings_used;
+   size_t strings_capacity;
+} staging_buffer_t;
+
+typedef struct {
+   adiak_lock_t lock;
+   category_entry_t *entries;
+   size_t capacity;
+   size_t count;
+} category_index_t;
+
+typedef struct {
+   adiak_lock_t lock;
+   type_cache_entry_t *entries;
+   adiak_datatype_t **types;
+   size_t capacity;
+   size_t count;
+} type_cache_t;
+
+typedef struct {
+   adiak_lock_t lock;
+   value_block_set_t set;
+} value_block_shard_t;
+
+/* Tools that receive each category on this rank, in tool list order. The
+   entries are built on first use from the tool list head they were built
+   for, and rebuilt when the head changes, e.g. when another Adiak copy
+   registers a tool. Protected by the tool lock.
+ */
+typedef struct {
+   int category;
+   int num_tools;
+   adiak_tool_t **tools;
+} tool_dispatch_entry_t;
+
+typedef struct {
+   adiak_tool_t *head;
+   int reportable_rank;
+   int count;
+   int capacity;
+   tool_dispatch_entry_t *entries;
+} tool_dispatch_t;
+
+/* Asynchronous tool dispatch, see adiak_set_async_dispatch. Updates are
+   queued in a ring of snapshots holding the record's top-level value,
+   datatype, interned name and subcategory, and a copy of its info.
+
+   A producer first reserves a slot, waiting without holding any lock while
+   the ring is full. It then updates the record and takes the next entry
+   from tail under the record's shard lock, so the snapshots of a record
+   are queued in update order, and marks the entry ready once it is
+   filled. Queued updates are delivered under the tool lock, usually by
+   the dispatcher thread, one update per lock hold; head only advances
+   after the callbacks returned. A tool lock holder that needs the queue
+   empty or has no room delivers the queued updates itself instead of
+   waiting for the dispatcher.
+
+   A queued snapshot shares the heap parts of the value with its record.
+   When a record value is replaced while snapshots are pending, the old
+   value is retired instead of freed, tagged with the queue tail, and the
+   dispatcher frees it once head has passed the tag. The retired list is
+   ordered by tag and protected by retired_lock, a leaf lock.
+ */
+#define ASYNC_QUEUE_CAPACITY 4096
+#define ASYNC_IDLE_SLEEP_USEC 200
+
+typedef struct {
+   const char *name;
+   int category;
+   adiak_value_t value;
+   adiak_datatype_t *dtype;
+   record_list_t *record;
+   adiak_record_info_t info;
+   int ready; /* set once the producer filled the entry */
+} async_entry_t;
+
+typedef struct retired_value_t {
+   struct retired_value_t *next;
+   uint64_t tag;
+   adiak_value_t value;
+   adiak_datatype_t *dtype;
+   int free_type;
+} retired_value_t;
+
+typedef struct {
+   int enabled;  /* updates are queued; changed under the tool lock */
+   int running;  /* cleared to stop the dispatcher once the queue is empty */
+   void *thread;
+   async_entry_t *entries;
+   uint64_t reserved; /* slots reserved by producers, queued or not yet */
+   uint64_t head;
+   uint64_t tail;
+   adiak_lock_t retired_lock;
+   retired_value_t *retired;
+   retired_value_t *retired_last;
+} async_dispatch_t;
+
+/* The record store. Library copies that share adiak_public share the store
+   of the first copy that uses it, if it has the same version and size;
+   otherwise they keep a local store. version and size must stay the first
+   fields. Bump RECORD_STORE_VERSION on every change to the layout of the
+   store or of anything it points to, e.g. records or shared datatypes.
+ */
+#define RECORD_STORE_VERSION 6
+
+typedef struct {
+   int version;
+   size_t size;
+   record_shard_t records[RECORD_SHARDS];
+   string_shard_t strings[STRING_SHARDS];
+   adiak_lock_t tool_lock;
+   int thread_staging;
+   int num_staging_buffers;
+   staging_buffer_t *staging_buffers;
+   uint64_t staging_epoch; /* bumped when adiak_clean frees the staging buffers */
+   record_table_t table;
+   category_index_t categories;
+   type_cache_t types;
+   value_block_shard_t value_blocks[VALUE_BLOCK_SHARDS];
+   tool_dispatch_t dispatch;
+   async_dispatch_t async;
+   uint64_t generation;
+   int packed_values; /* set once a tool registered with PACKED_VALUES_VERSION */
+} record_store_t;
+
+/* Bump ADIAK_T_VERSION on every change to the layout of adiak_t. Version 2
+   kept the record store inline; version 3 points to it.
+ */
 typedef struct {
    int minimum_version;
    int version;
@@ -49,17 +496,36 @@ typedef struct {
    adiak_tool_t **tool_list;
    int use_mpi;
    record_list_t *shared_record_list;
-   record_list_t *record_hash[RECORD_HASH_SIZE];
+   record_list_t *record_hash[RECORD_HASH_SIZE]; /* superseded by record_store in v3 */
+   // Below fields are present in v3
+   record_store_t *record_store; /* set by the first copy that uses it */
 } adiak_t;
 
-#define ADIAK_T_VERSION 1
+#define ADIAK_T_VERSION 3
+
+adiak_t adiak_public = { .minimum_version = ADIAK_T_VERSION, .version = ADIAK_T_VERSION,
+                         .reportable_rank = 1 };
 
-adiak_t adiak_public = { ADIAK_T_VERSION, ADIAK_T_VERSION, 0, 1, NULL, 0, NULL, { NULL } };
+/* This library's record store. It is used if adiak_public is shared with
+   an older library copy, or with one whose store doesn't match.
+ */
+static record_store_t local_record_store = { .version = RECORD_STORE_VERSION,
+                                             .size = sizeof(record_store_t) };
 
-/* With ADIAK_T_VERSION 1 or higher the hash list is stored in the adiak_t struct.
-   We fall back to a local hash list if a lower version is found as adiak_public.
+/* A name handle caches everything adiak_update_handle needs to skip the
+   name lookup and, for non-container types, the type string parsing.
+   Handles live in a record shard arena and are freed by adiak_clean.
  */
-static record_list_t* local_record_hash[RECORD_HASH_SIZE];
+struct adiak_name_handle_s {
+   const char *name;
+   uint64_t hash;
+   int category;
+   const char *subcategory;
+   const char *typestr;
+   adiak_type_t toptype;
+   adiak_datatype_t *dtype;   /* pre-parsed datatype for non-container types */
+   record_list_t *record;     /* resolved on first update */
+};
 
 static int measure_adiak_walltime;
 static int measure_adiak_systime;
@@ -90,34 +556,115 @@ static adiak_datatype_t base_catstring_ref = { adiak_catstring, adiak_categorica
 static adiak_datatype_t base_jsonstring_ref = { adiak_jsonstring, adiak_categorical, 0, 0, NULL, 1, 0, sizeof(char*) };
 static adiak_datatype_t base_path_ref = { adiak_path, adiak_categorical, 0, 0, NULL, 1, 0, sizeof(char*) };
 
+static adiak_flat_type_t base_flat_types[] = {
+   { adiak_long, 0, 0, 0, 1, &base_long },
+   { adiak_ulong, 0, 0, 0, 1, &base_ulong },
+   { adiak_longlong, 0, 0, 0, 1, &base_longlong },
+   { adiak_ulonglong, 0, 0, 0, 1, &base_ulonglong },
+   { adiak_int, 0, 0, 0, 1, &base_int },
+   { adiak_int, 0, 0, 0, 1, &base_i8 },
+   { adiak_int, 0, 0, 0, 1, &base_i16 },
+   { adiak_uint, 0, 0, 0, 1, &base_u8 },
+   { adiak_uint, 0, 0, 0, 1, &base_u16 },
+   { adiak_uint, 0, 0, 0, 1, &base_uint },
+   { adiak_double, 0, 0, 0, 1, &base_double },
+   { adiak_double, 0, 0, 0, 1, &base_float },
+   { adiak_date, 0, 0, 0, 1, &base_date },
+   { adiak_timeval, 0, 0, 0, 1, &base_timeval },
+   { adiak_version, 0, 0, 0, 1, &base_version },
+   { adiak_string, 0, 0, 0, 1, &base_string },
+   { adiak_catstring, 0, 0, 0, 1, &base_catstring },
+   { adiak_jsonstring, 0, 0, 0, 1, &base_jsonstring },
+   { adiak_path, 0, 0, 0, 1, &base_path },
+   { adiak_version, 0, 1, 0, 1, &base_version_ref },
+   { adiak_string, 0, 1, 0, 1, &base_string_ref },
+   { adiak_catstring, 0, 1, 0, 1, &base_catstring_ref },
+   { adiak_jsonstring, 0, 1, 0, 1, &base_jsonstring_ref },
+   { adiak_path, 0, 1, 0, 1, &base_path_ref }
+};
+
 static adiak_t* adiak_get_config();
 static void adiak_register(int adiak_version, int category,
                            adiak_nameval_cb_t nv,
                            adiak_nameval_info_cb_t nvi,
+                           adiak_batch_cb_t bcb, int batch_size, tool_filter_t *filter,
                            int report_on_all_ranks, void *opaque_val);
+static void free_tool(adiak_tool_t *tool);
+static tool_filter_t *new_tool_filter(const char *names, const char *subcategories);
+static void free_tool_filter(tool_filter_t *filter);
+static int tool_filter_matches(tool_filter_t *filter, const char *name, const char *subcategory);
 
-static int find_end_brace(const char *typestr, char endchar, int typestr_start, int typestr_end);
 static int parse_scalar_len_spec(const char* typestr, int *pos);
 static adiak_datatype_t *parse_typestr(const char *typestr, va_list *ap);
-static adiak_datatype_t *parse_typestr_helper(const char *typestr, int typestr_start, int typestr_end,
-                                              int is_reference, va_list *ap, int *new_typestr_start);
+static int parse_typestr_full(typestr_parser_t *p, adiak_datatype_t **out);
 static void free_adiak_type(adiak_datatype_t *t);
+static void free_adiak_type_tree(adiak_datatype_t *t);
+static int type_cache_contains(adiak_datatype_t *t);
+static int is_shared_type(adiak_datatype_t *t);
+static adiak_datatype_t *intern_datatype(adiak_datatype_t *t);
+static uint64_t strhash_mix(uint64_t h);
 static void free_adiak_value(adiak_datatype_t *t, adiak_value_t *v);
 static void free_adiak_value_worker(adiak_datatype_t *t, adiak_value_t *v);
+static void free_value_tree(adiak_datatype_t *t, adiak_value_t *v);
+static int value_block_remove(void *block);
+static int value_block_add(void *block);
+static void value_block_set_clear(value_block_set_t *set);
 
 static adiak_type_t toplevel_type(const char *typestr);
+static int is_basetype(adiak_type_t t);
+static int is_numeric_basetype(adiak_type_t t);
 static int calc_size(adiak_datatype_t *datatype);
+static int read_ref_value(adiak_datatype_t *t, unsigned char *ptr, adiak_value_t *v);
+static int convert_numeric_array(adiak_value_t *values, adiak_datatype_t *elem, const void *ptr, int count);
 static int copy_value(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr);
-
-static record_list_t* record_nameval(const char *name, int category, const char *subcategory,
-                                     adiak_value_t *value, adiak_datatype_t *dtype);
+static int is_packable(adiak_datatype_t *datatype);
+static adiak_datatype_t *pack_value(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr, int is_owned);
+static int unpack_value(adiak_datatype_t *type, adiak_value_t *value, unpacked_value_t *out);
+static void free_unpacked_value(unpacked_value_t *unpacked);
+
+static record_list_t* record_nameval(record_shard_t *shard, const char *name, uint64_t hashval,
+                                     int category, const char *subcategory,
+                                     adiak_value_t *value, adiak_datatype_t *dtype,
+                                     const struct timespec *ts);
+static record_list_t* new_record(record_shard_t* shard, const char *name, uint64_t hashval);
+static void update_record(record_shard_t *shard, record_list_t *rec, int category, const char *subcategory,
+                          adiak_value_t *value, adiak_datatype_t *dtype, const struct timespec *ts);
+static void free_record_value(record_list_t *rec);
+static size_t record_position(record_list_t *rec);
+static void change_log_append(record_shard_t *shard, record_list_t *rec);
+static uint64_t record_generation(record_list_t *rec);
+static size_t changes_since(uint64_t generation, uint64_t current, change_entry_t **entries);
+static void retire_record_value(record_list_t *rec, int free_type);
 
 static int measure_walltime();
 static int measure_systime();
 static int measure_cputime();
 
-static size_t strhash_djb2(const char*);
-static record_list_t* find_record_by_name(const char* str);
+static uint64_t strhash(const char*);
+static record_store_t* get_record_store(adiak_t* adiak_config);
+static record_shard_t* get_record_shard(uint64_t hash);
+static string_shard_t* get_string_shard(uint64_t hash);
+static void lock_acquire(adiak_lock_t* lock);
+static void lock_release(adiak_lock_t* lock);
+static int lock_held(adiak_lock_t* lock);
+static void async_wait(int *spins);
+static void async_deliver(record_store_t *store, uint64_t max);
+static void async_stop(record_store_t *store);
+static int acquire_tool_lock(int wait_drained);
+static void release_tool_lock();
+static record_list_t* record_list_head(adiak_t* adiak_config);
+static record_list_t* record_table_get(record_table_t *table, size_t i);
+static void category_index_move(record_list_t *rec, int is_new, int from, int to);
+static size_t* category_index_snapshot(int category, size_t *count);
+static category_entry_t* category_index_find(category_index_t *index, int category, int create);
+static int stage_namevalue(const char *name, int category, const char *subcategory,
+                           adiak_value_t *value, adiak_datatype_t *type);
+static record_list_t* record_index_find(record_index_t* index, const char* name, uint64_t hash);
+static void* arena_alloc(adiak_arena_t* arena, size_t size);
+static const char* intern_string(const char* str);
+static const char* intern_string_hashed(const char* str, uint64_t hash);
+static int is_interned_string(const char* str);
+static char* copy_string_value(adiak_datatype_t* t, const char* str);
 
 #define MAX_PATH_LEN 4096
 
@@ -131,57 +678,538 @@ adiak_datatype_t *adiak_new_datatype(const char *typestr, ...)
    return t;
 }
 
-int adiak_raw_namevalue(const char *name, int category, const char *subcategory,
-                        adiak_value_t *value, adiak_datatype_t *type)
+/* Set while this thread delivers queued updates; its own updates are then
+   reported right away.
+ */
+static __thread int delivering_queued;
+
+/* Tool callbacks are serialized by the tool lock, so tools need not be
+   thread-safe. While no tool is registered the lock is skipped, and so is
+   the dispatch; a tool registered concurrently misses that update. The
+   tool lock must be taken before any record shard lock. Record updates
+   don't hold it; they take it afterwards to deliver, see dispatch_record.
+
+   In async mode with wait_drained, the caller also waits for the
+   dispatcher to deliver everything queued. It waits without holding the
+   lock, so the dispatcher can take it. A caller that already held the
+   lock, e.g. a tool callback, can't let go of it, and delivers the queued
+   updates itself.
+ */
+static int acquire_tool_lock(int wait_drained)
 {
-   adiak_tool_t *tool;
-   adiak_record_info_t *info_ptr = NULL;
+   adiak_t* adiak_config = adiak_get_config();
+   record_store_t* store;
+   uint64_t queued;
+   int held, spins = 0;
 
-   if (category != adiak_control) {
-      record_list_t* rec = record_nameval(name, category, subcategory, value, type);
-      info_ptr = rec->info;
+   if (__atomic_load_n(adiak_config->tool_list, __ATOMIC_ACQUIRE) == NULL)
+      return 0;
+   store = get_record_store(adiak_config);
+
+   for (;;) {
+      held = lock_held(&store->tool_lock);
+      lock_acquire(&store->tool_lock);
+      if (!wait_drained || !store->async.enabled || delivering_queued)
+         return 1;
+      queued = __atomic_load_n(&store->async.tail, __ATOMIC_ACQUIRE) - store->async.head;
+      if (queued == 0)
+         return 1;
+      if (held) {
+         async_deliver(store, queued);
+         return 1;
+      }
+      lock_release(&store->tool_lock);
+      async_wait(&spins);
    }
+}
 
-   adiak_t* adiak_config = adiak_get_config();
-   adiak_tool_t** tool_list = adiak_config->tool_list;
+static void release_tool_lock()
+{
+   lock_release(&get_record_store(adiak_get_config())->tool_lock);
+}
+
+static int tool_receives(adiak_t *adiak_config, adiak_tool_t *tool, int category)
+{
+   if (!tool->report_on_all_ranks && !adiak_config->reportable_rank)
+      return 0;
+   return tool->category == adiak_category_all || tool->category == category;
+}
+
+static void tool_dispatch_clear(tool_dispatch_t *dispatch)
+{
+   int i;
+   for (i = 0; i < dispatch->count; ++i)
+      free(dispatch->entries[i].tools);
+   free(dispatch->entries);
+   memset(dispatch, 0, sizeof(*dispatch));
+}
+
+/* Return the tools that receive category, or NULL if the entry can't be
+   allocated. Callers hold the tool lock.
+ */
+static tool_dispatch_entry_t* tool_dispatch_find(adiak_t *adiak_config, tool_dispatch_t *dispatch, int category)
+{
+   adiak_tool_t *head = __atomic_load_n(adiak_config->tool_list, __ATOMIC_ACQUIRE), *tool;
+   tool_dispatch_entry_t *entry, *entries;
+   int i, n = 0;
+
+   if (dispatch->head != head || dispatch->reportable_rank != adiak_config->reportable_rank) {
+      tool_dispatch_clear(dispatch);
+      dispatch->head = head;
+      dispatch->reportable_rank = adiak_config->reportable_rank;
+   }
+
+   /* there are only a few categories */
+   for (i = 0; i < dispatch->count; ++i)
+      if (dispatch->entries[i].category == category)
+         return dispatch->entries + i;
+
+   if (dispatch->count == dispatch->capacity) {
+      int capacity = dispatch->capacity ? 2 * dispatch->capacity : 8;
+      entries = (tool_dispatch_entry_t *) realloc(dispatch->entries, capacity * sizeof(tool_dispatch_entry_t));
+      if (!entries)
+         return NULL;
+      dispatch->entries = entries;
+      dispatch->capacity = capacity;
+   }
+
+   entry = dispatch->entries + dispatch->count;
+   entry->category = category;
+   entry->num_tools = 0;
+   entry->tools = NULL;
+   for (tool = head; tool != NULL; tool = tool->next)
+      if (tool_receives(adiak_config, tool, category))
+         ++n;
+   if (n > 0) {
+      entry->tools = (adiak_tool_t **) malloc(n * sizeof(adiak_tool_t *));
+      if (!entry->tools)
+         return NULL;
+      for (tool = head; tool != NULL; tool = tool->next)
+         if (tool_receives(adiak_config, tool, category))
+            entry->tools[entry->num_tools++] = tool;
+   }
+   ++dispatch->count;
+   return entry;
+}
+
+/* Whether tool has the batch and filter fields, see TOOL_EXTENDED_LAYOUT */
+static int has_extended_layout(adiak_tool_t *tool)
+{
+   return (tool->version & TOOL_EXTENDED_LAYOUT) != 0;
+}
+
+/* The adiak_version a tool registered with */
+static int tool_version(adiak_tool_t *tool)
+{
+   return tool->version & ~TOOL_EXTENDED_LAYOUT;
+}
+
+static int is_batch_tool(adiak_tool_t *tool)
+{
+   return has_extended_layout(tool) && !tool->name_val_cb && !tool->nameval_info_cb && tool->batch_cb;
+}
+
+/* Deliver the pending names to a batch tool, followed by the control value
+   name if given. Callers hold the tool lock. The shard locks of the
+   pending records are held during the callback, so that the entries stay
+   valid; they are taken in shard order, see the lock order.
+ */
+static void batch_deliver(adiak_tool_t *tool, const char *name, adiak_value_t *value,
+                          adiak_datatype_t *type, adiak_record_info_t *info)
+{
+   tool_batch_t *batch = tool->batch;
+   record_store_t *store = get_record_store(adiak_get_config());
+   unsigned char locked[RECORD_SHARDS];
+   unpacked_value_t *unpacked = NULL;
+   int count = batch->count, n = count + (name ? 1 : 0), i, k;
+   size_t p;
+
+   if (n == 0 || batch->delivering)
+      return;
+   if (n > batch->entries_capacity) {
+      adiak_batch_entry_t *entries = (adiak_batch_entry_t *) realloc(batch->entries, n * sizeof(adiak_batch_entry_t));
+      if (!entries)
+         return;
+      batch->entries = entries;
+      batch->entries_capacity = n;
+   }
 
-   for (tool = *tool_list; tool != NULL; tool = tool->next) {
-      if (!tool->report_on_all_ranks && !adiak_config->reportable_rank)
+   memset(locked, 0, sizeof(locked));
+   for (i = 0; i < count; ++i)
+      locked[get_record_shard(strhash(batch->records[i]->name)) - store->records] = 1;
+   for (k = 0; k < RECORD_SHARDS; ++k)
+      if (locked[k])
+         lock_acquire(&store->records[k].lock);
+
+   for (i = 0; i < count; ++i) {
+      record_list_t *rec = batch->records[i];
+      batch->entries[i].name = rec->name;
+      batch->entries[i].type = rec->dtype;
+      batch->entries[i].value = rec->value;
+      batch->entries[i].info = rec->info;
+   }
+   if (name) {
+      batch->entries[i].name = name;
+      batch->entries[i].type = type;
+      batch->entries[i].value = value;
+      batch->entries[i].info = info;
+   }
+
+   /* older tools get packed values unpacked; if that fails, the names stay pending */
+   for (i = 0; i < count && tool_version(tool) < PACKED_VALUES_VERSION; ++i) {
+      if (batch->entries[i].type->is_reference != PACKED_REFERENCE)
          continue;
-      if (tool->category != adiak_category_all && tool->category != category)
+      if (!unpacked)
+         unpacked = (unpacked_value_t *) calloc(count, sizeof(unpacked_value_t));
+      if (!unpacked || unpack_value(batch->entries[i].type, batch->entries[i].value, unpacked + i) != 0)
+         goto done;
+      batch->entries[i].type = unpacked[i].type;
+      batch->entries[i].value = &unpacked[i].value;
+   }
+
+   for (i = 0; i < count; ++i) {
+      p = record_position(batch->records[i]);
+      batch->pending[p / 8] &= (unsigned char) ~(1u << (p % 8));
+   }
+   batch->count = 0;
+
+   /* names set by the callback are added to the next batch */
+   batch->delivering = 1;
+   tool->batch_cb(batch->entries, n, tool->opaque_val);
+   batch->delivering = 0;
+
+done:
+   if (unpacked) {
+      for (i = 0; i < count; ++i)
+         free_unpacked_value(unpacked + i);
+      free(unpacked);
+   }
+   for (k = RECORD_SHARDS - 1; k >= 0; --k)
+      if (locked[k])
+         lock_release(&store->records[k].lock);
+}
+
+/* Add rec to a batch tool's pending names, and deliver the batch if it is
+   full.
+ */
+static void batch_add(adiak_tool_t *tool, record_list_t *rec)
+{
+   tool_batch_t *batch = tool->batch;
+   size_t p = record_position(rec);
+
+   if (p / 8 >= batch->pending_bytes) {
+      size_t bytes = batch->pending_bytes ? 2 * batch->pending_bytes : 64;
+      unsigned char *pending;
+      while (p / 8 >= bytes)
+         bytes *= 2;
+      pending = (unsigned char *) realloc(batch->pending, bytes);
+      if (!pending)
+         return;
+      memset(pending + batch->pending_bytes, 0, bytes - batch->pending_bytes);
+      batch->pending = pending;
+      batch->pending_bytes = bytes;
+   }
+   if (batch->pending[p / 8] & (1u << (p % 8)))
+      return;
+
+   if (batch->count == batch->capacity) {
+      int capacity = batch->capacity ? 2 * batch->capacity : 64;
+      record_list_t **records = (record_list_t **) realloc(batch->records, capacity * sizeof(record_list_t *));
+      if (!records)
+         return;
+      batch->records = records;
+      batch->capacity = capacity;
+   }
+   batch->records[batch->count++] = rec;
+   batch->pending[p / 8] |= (unsigned char) (1u << (p % 8));
+
+   if (tool->batch_size > 0 && batch->count >= tool->batch_size)
+      batch_deliver(tool, NULL, NULL, NULL, NULL);
+}
+
+/* Invoke one tool's callback if its filter matches. rec is the record for
+   name, or NULL for control values. Without record info, *info_ptr is set
+   to info the first time a tool needs it, so all tools see the same info.
+   Likewise, a packed value is unpacked into unpacked the first time an
+   older tool needs it.
+ */
+static void dispatch_to_tool(adiak_tool_t *tool, const char *name, int category, const char *subcategory,
+                             adiak_value_t *value, adiak_datatype_t *type, record_list_t *rec,
+                             adiak_record_info_t **info_ptr, adiak_record_info_t *info,
+                             unpacked_value_t *unpacked)
+{
+   /* control values are not filtered */
+   if (rec && has_extended_layout(tool) && tool->filter
+       && !tool_filter_matches(tool->filter, name, subcategory))
+      return;
+
+   /* batch_deliver unpacks for batch tools */
+   if (type->is_reference == PACKED_REFERENCE && tool_version(tool) < PACKED_VALUES_VERSION && !is_batch_tool(tool)) {
+      if (!unpacked->type && unpack_value(type, value, unpacked) != 0)
+         return;
+      type = unpacked->type;
+      value = &unpacked->value;
+   }
+
+   if (tool->name_val_cb) {
+      tool->name_val_cb(name, category, subcategory, value, type, tool->opaque_val);
+      return;
+   }
+   if (tool->nameval_info_cb || !rec) {
+      if (!*info_ptr) {
+         memset(info, 0, sizeof(adiak_record_info_t));
+         info->category = category;
+         info->subcategory = subcategory;
+         adksys_clock_realtime(&info->timestamp);
+         *info_ptr = info;
+      }
+   }
+   if (tool->nameval_info_cb)
+      tool->nameval_info_cb(name, value, type, *info_ptr, tool->opaque_val);
+   else if (is_batch_tool(tool) && rec)
+      batch_add(tool, rec);
+   else if (is_batch_tool(tool))
+      batch_deliver(tool, name, value, type, *info_ptr);
+}
+
+/* Report a name/value pair to all tools in dispatch that receive its
+   category. A control value also delivers the pending batches of batch
+   tools that don't receive it.
+ */
+static void deliver_nameval(tool_dispatch_t *dispatch, const char *name, int category, const char *subcategory,
+                            adiak_value_t *value, adiak_datatype_t *type, record_list_t *rec,
+                            adiak_record_info_t *info_ptr)
+{
+   adiak_t* adiak_config = adiak_get_config();
+   tool_dispatch_entry_t *entry = tool_dispatch_find(adiak_config, dispatch, category);
+   adiak_record_info_t info;
+   unpacked_value_t unpacked;
+   adiak_tool_t *tool;
+   int i;
+
+   unpacked.type = NULL;
+
+   if (category == adiak_control)
+      for (tool = __atomic_load_n(adiak_config->tool_list, __ATOMIC_ACQUIRE); tool != NULL; tool = tool->next)
+         if (is_batch_tool(tool) && !tool_receives(adiak_config, tool, category))
+            batch_deliver(tool, NULL, NULL, NULL, NULL);
+
+   if (entry) {
+      for (i = 0; i < entry->num_tools; ++i)
+         dispatch_to_tool(entry->tools[i], name, category, subcategory, value, type, rec, &info_ptr, &info,
+                          &unpacked);
+   } else {
+      for (tool = __atomic_load_n(adiak_config->tool_list, __ATOMIC_ACQUIRE); tool != NULL; tool = tool->next)
+         if (tool_receives(adiak_config, tool, category))
+            dispatch_to_tool(tool, name, category, subcategory, value, type, rec, &info_ptr, &info, &unpacked);
+   }
+   free_unpacked_value(&unpacked);
+}
+
+#define DISPATCH_NONE 0
+#define DISPATCH_SYNC 1
+#define DISPATCH_ASYNC 2
+
+/* Reserve a queue slot for an update, waiting while the queue is full.
+   Returns 0 if async dispatch was disabled meanwhile. A producer that
+   holds the tool lock delivers the queued updates itself, as the
+   dispatcher can't take the lock. async_stop waits for the reserved slots
+   to be queued; the reservation and the check of enabled below are
+   sequentially consistent with its update of enabled and its check of the
+   reservations.
+ */
+static int async_reserve(record_store_t *store)
+{
+   async_dispatch_t *async = &store->async;
+   uint64_t reserved = __atomic_load_n(&async->reserved, __ATOMIC_RELAXED);
+   int spins = 0;
+
+   for (;;) {
+      if (reserved - __atomic_load_n(&async->head, __ATOMIC_ACQUIRE) < ASYNC_QUEUE_CAPACITY) {
+         if (__atomic_compare_exchange_n(&async->reserved, &reserved, reserved + 1, 1,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            break;
          continue;
-      if (tool->name_val_cb) {
-         tool->name_val_cb(name, category, subcategory, value, type, tool->opaque_val);
-      } else if (tool->nameval_info_cb) {
-         adiak_record_info_t info;
-         memset(&info, 0, sizeof(adiak_record_info_t));
-         if (!info_ptr) {
-            info.category = category;
-            info.subcategory = subcategory;
-            adksys_clock_realtime(&info.timestamp);
-            info_ptr = &info;
-         }
-         tool->nameval_info_cb(name, value, type, info_ptr, tool->opaque_val);
       }
+      if (!__atomic_load_n(&async->enabled, __ATOMIC_ACQUIRE))
+         return 0;
+      if (lock_held(&store->tool_lock))
+         async_deliver(store, ASYNC_QUEUE_CAPACITY);
+      else
+         async_wait(&spins);
+      reserved = __atomic_load_n(&async->reserved, __ATOMIC_RELAXED);
+   }
+
+   if (__atomic_load_n(&async->enabled, __ATOMIC_SEQ_CST))
+      return 1;
+   __atomic_fetch_sub(&async->reserved, 1, __ATOMIC_SEQ_CST);
+   return 0;
+}
+
+/* Queue a snapshot of rec's name/value for the dispatcher, in a slot
+   reserved with async_reserve. Callers hold the record's shard lock.
+ */
+static void async_enqueue(record_store_t *store, record_list_t *rec)
+{
+   async_dispatch_t *async = &store->async;
+   uint64_t tail = __atomic_fetch_add(&async->tail, 1, __ATOMIC_ACQ_REL);
+   async_entry_t *entry = async->entries + (tail & (ASYNC_QUEUE_CAPACITY - 1));
+
+   entry->name = rec->name;
+   entry->category = rec->category;
+   entry->value = *rec->value;
+   entry->dtype = rec->dtype;
+   entry->record = rec;
+   if (rec->info) {
+      entry->info = *rec->info;
+   } else {
+      memset(&entry->info, 0, sizeof(adiak_record_info_t));
+      entry->info.category = rec->category;
+      entry->info.subcategory = rec->subcategory;
+      adksys_clock_realtime(&entry->info.timestamp);
    }
+   __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+}
+
+/* Decide how a record update is reported to tools, before the record is
+   locked: not at all while no tool is registered, through the queue in
+   async mode, or else right away. Updates set while delivering queued
+   updates are reported right away.
+ */
+static int dispatch_prepare()
+{
+   adiak_t* adiak_config = adiak_get_config();
+   record_store_t* store;
+
+   if (__atomic_load_n(adiak_config->tool_list, __ATOMIC_ACQUIRE) == NULL)
+      return DISPATCH_NONE;
+   store = get_record_store(adiak_config);
+   if (__atomic_load_n(&store->async.enabled, __ATOMIC_ACQUIRE) && !delivering_queued
+       && async_reserve(store))
+      return DISPATCH_ASYNC;
+   return DISPATCH_SYNC;
+}
+
+/* Continue the dispatch of an update of rec, or of a failed update if rec
+   is NULL, while its shard lock is still held. A queued update is queued
+   now; otherwise the generation of the update is returned for
+   dispatch_record.
+ */
+static uint64_t dispatch_locked(int mode, record_list_t *rec)
+{
+   record_store_t* store = get_record_store(adiak_get_config());
+
+   if (mode == DISPATCH_ASYNC && rec)
+      async_enqueue(store, rec);
+   else if (mode == DISPATCH_ASYNC)
+      __atomic_fetch_sub(&store->async.reserved, 1, __ATOMIC_SEQ_CST);
+   else if (mode == DISPATCH_SYNC && rec)
+      return record_generation(rec);
    return 0;
 }
 
-int adiak_namevalue(const char *name, int category, const char *subcategory, const char *typestr, ...)
+/* Report an update of rec to all tools that receive its category, after
+   its shard lock was released. If rec was updated again meanwhile, the
+   newer update is reported by its own writer instead.
+ */
+static void dispatch_record(int mode, record_shard_t *shard, record_list_t *rec, uint64_t generation)
 {
-   va_list ap;
-   adiak_datatype_t *t;
-   adiak_type_t toptype;
-   adiak_value_t *value = NULL;
-   void *container_ptr = NULL;
-   char *string_ptr = NULL;
+   record_store_t* store = get_record_store(adiak_get_config());
+
+   if (mode != DISPATCH_SYNC || !acquire_tool_lock(0))
+      return;
+   lock_acquire(&shard->lock);
+   if (record_generation(rec) == generation)
+      deliver_nameval(&store->dispatch, rec->name, rec->category, rec->subcategory, rec->value, rec->dtype,
+                      rec, rec->info);
+   lock_release(&shard->lock);
+   release_tool_lock();
+}
+
+/* Report a control value to all tools that receive it. In async mode the
+   queued updates are delivered first.
+ */
+static int dispatch_control(const char *name, const char *subcategory,
+                            adiak_value_t *value, adiak_datatype_t *type)
+{
+   if (acquire_tool_lock(1)) {
+      deliver_nameval(&get_record_store(adiak_get_config())->dispatch, name, adiak_control, subcategory,
+                      value, type, NULL, NULL);
+      release_tool_lock();
+   }
+   return 0;
+}
+
+/* Record name/value in the shared record store and report it to tools */
+static int store_namevalue(const char *name, int category, const char *subcategory,
+                           adiak_value_t *value, adiak_datatype_t *type, const struct timespec *ts)
+{
+   record_list_t* rec;
+   record_shard_t* shard;
+   uint64_t hashval, generation;
+   int mode;
+
+   hashval = strhash(name);
+   shard = get_record_shard(hashval);
+   mode = dispatch_prepare();
+   lock_acquire(&shard->lock);
+
+   rec = record_nameval(shard, name, hashval, category, subcategory, value, type, ts);
+   if (!rec) {
+      free_adiak_value_worker(type, value);
+      free_adiak_type(type);
+   }
+   generation = dispatch_locked(mode, rec);
 
-   toptype = toplevel_type(typestr);
-   if (toptype == adiak_type_unset)
+   lock_release(&shard->lock);
+   if (!rec)
       return -1;
-   value = (adiak_value_t *) malloc(sizeof(adiak_value_t));
+   dispatch_record(mode, shard, rec, generation);
+   return 0;
+}
 
-   va_start(ap, typestr);
+static int set_namevalue(const char *name, int category, const char *subcategory,
+                         adiak_value_t *value, adiak_datatype_t *type)
+{
+   if (category == adiak_control)
+      return dispatch_control(name, subcategory, value, type);
+   if (__atomic_load_n(&get_record_store(adiak_get_config())->thread_staging, __ATOMIC_RELAXED))
+      return stage_namevalue(name, category, subcategory, value, type);
+
+   return store_namevalue(name, category, subcategory, value, type, NULL);
+}
+
+int adiak_raw_namevalue(const char *name, int category, const char *subcategory,
+                        adiak_value_t *value, adiak_datatype_t *type)
+{
+   int result;
+
+   if (category == adiak_control)
+      return dispatch_control(name, subcategory, value, type);
+
+   type = intern_datatype(type);
+   if (!type) {
+      free(value);
+      return -1;
+   }
+   result = set_namevalue(name, category, subcategory, value, type);
+   free(value);
+   return result;
+}
+
+/* Build a value and datatype for typestr from the varargs in ap. If dtype
+   is given it is used instead of parsing typestr; this only works for
+   non-container types, which don't consume additional varargs. If
+   is_owned, the timeval, string, or container pointer in ap was malloc'd
+   by the caller, and is kept or freed instead of copied. On failure it
+   stays with the caller.
+ */
+static int make_value_from_args(const char *typestr, adiak_type_t toptype, adiak_datatype_t *dtype, va_list *ap,
+                                int is_owned, adiak_value_t *value, adiak_datatype_t **out_type)
+{
+   adiak_datatype_t *t;
+   void *container_ptr = NULL;
+   char *string_ptr = NULL;
 
    switch (toptype) {
       case adiak_type_unset:
@@ -189,22 +1217,26 @@ int adiak_namevalue(const char *name, int category, const char *subcategory, con
       case adiak_long:
       case adiak_ulong:
       case adiak_date:
-         value->v_long = va_arg(ap, long);
+         value->v_long = va_arg(*ap, long);
          break;
       case adiak_int:
       case adiak_uint:
-         value->v_int = va_arg(ap, int);
+         value->v_int = va_arg(*ap, int);
          break;
       case adiak_longlong:
       case adiak_ulonglong:
-         value->v_longlong = va_arg(ap, long long);
+         value->v_longlong = va_arg(*ap, long long);
          break;
       case adiak_double:
-         value->v_double = va_arg(ap, double);
+         value->v_double = va_arg(*ap, double);
          break;
       case adiak_timeval: {
-         struct timeval *v = (struct timeval *) malloc(sizeof(struct timeval));
-         *v = *va_arg(ap, struct timeval *);
+         struct timeval *v = va_arg(*ap, struct timeval *);
+         if (!is_owned) {
+            struct timeval *src = v;
+            v = (struct timeval *) malloc(sizeof(struct timeval));
+            *v = *src;
+         }
          value->v_ptr = v;
          break;
       }
@@ -213,33 +1245,212 @@ int adiak_namevalue(const char *name, int category, const char *subcategory, con
       case adiak_catstring:
       case adiak_jsonstring:
       case adiak_path:
-         string_ptr = va_arg(ap, char*);
+         string_ptr = va_arg(*ap, char*);
          break;
       case adiak_range:
       case adiak_set:
       case adiak_list:
       case adiak_tuple:
-         container_ptr = va_arg(ap, void*);
+         container_ptr = va_arg(*ap, void*);
          break;
    }
 
-   t = parse_typestr(typestr, &ap);
-   va_end(ap);
-   if (!t) {
-      free(value);
+   t = dtype ? dtype : parse_typestr(typestr, ap);
+   if (t && is_owned && t->is_reference) {
+      free_adiak_type(t);
+      t = NULL;
+   }
+   if (!t) {
+      if (toptype == adiak_timeval && !is_owned)
+         free(value->v_ptr);
       return -1;
    }
 
    if (string_ptr) {
-      value->v_ptr = (t->is_reference ? string_ptr : strdup(string_ptr));
+      if (t->is_reference)
+         value->v_ptr = string_ptr;
+      else if (!is_owned)
+         value->v_ptr = copy_string_value(t, string_ptr);
+      else if (t->dtype == adiak_catstring || t->dtype == adiak_path) {
+         value->v_ptr = copy_string_value(t, string_ptr);
+         free(string_ptr);
+      } else
+         value->v_ptr = string_ptr;
    } else if (container_ptr) {
       if (t->is_reference)
          value->v_ptr = container_ptr;
-      else
-         copy_value(value, t, container_ptr);
+      else if (is_packable(t)
+               && __atomic_load_n(&get_record_store(adiak_get_config())->packed_values, __ATOMIC_ACQUIRE)) {
+         t = pack_value(value, t, container_ptr, is_owned);
+         if (!t)
+            return -1;
+      } else {
+         if (copy_value(value, t, container_ptr) == -1) {
+            free_adiak_type(t);
+            return -1;
+         }
+         if (is_owned)
+            free(container_ptr);
+      }
+   }
+
+   *out_type = t;
+   return 0;
+}
+
+int adiak_namevalue(const char *name, int category, const char *subcategory, const char *typestr, ...)
+{
+   va_list ap;
+   adiak_datatype_t *t;
+   adiak_value_t value;
+   int result;
+
+   va_start(ap, typestr);
+   result = make_value_from_args(typestr, toplevel_type(typestr), NULL, &ap, 0, &value, &t);
+   va_end(ap);
+   if (result != 0)
+      return -1;
+
+   return set_namevalue(name, category, subcategory, &value, t);
+}
+
+int adiak_namevalue_take(const char *name, int category, const char *subcategory, const char *typestr, ...)
+{
+   va_list ap;
+   adiak_datatype_t *t;
+   adiak_value_t value;
+   int result;
+
+   va_start(ap, typestr);
+   result = make_value_from_args(typestr, toplevel_type(typestr), NULL, &ap, 1, &value, &t);
+   va_end(ap);
+   if (result != 0)
+      return -1;
+
+   result = set_namevalue(name, category, subcategory, &value, t);
+   /* control values aren't stored */
+   if (category == adiak_control)
+      free_adiak_value_worker(t, &value);
+   return result;
+}
+
+adiak_name_handle_t adiak_get_handle(const char *name, int category, const char *subcategory, const char *typestr)
+{
+   adiak_name_handle_t handle;
+   adiak_type_t toptype = adiak_type_unset;
+   adiak_datatype_t *dtype = NULL;
+
+   if (!name)
+      return NULL;
+
+   if (typestr) {
+      toptype = toplevel_type(typestr);
+      if (toptype == adiak_type_unset)
+         return NULL;
+      if (is_basetype(toptype)) {
+         dtype = adiak_new_datatype(typestr);
+         if (!dtype)
+            return NULL;
+      }
+   }
+
+   uint64_t hashval = strhash(name);
+   record_shard_t* shard = get_record_shard(hashval);
+
+   lock_acquire(&shard->lock);
+   handle = (adiak_name_handle_t) arena_alloc(&shard->arena, sizeof(*handle));
+   lock_release(&shard->lock);
+   if (!handle) {
+      free_adiak_type(dtype);
+      return NULL;
+   }
+   memset(handle, 0, sizeof(*handle));
+   handle->name = intern_string(name);
+   handle->hash = hashval;
+   handle->category = category;
+   handle->subcategory = subcategory ? intern_string(subcategory) : NULL;
+   handle->typestr = typestr ? intern_string(typestr) : NULL;
+   handle->toptype = toptype;
+   handle->dtype = dtype;
+
+   return handle;
+}
+
+static int set_handle_value(adiak_name_handle_t handle, adiak_value_t *value, adiak_datatype_t *type)
+{
+   record_list_t *rec;
+   record_shard_t *shard;
+   uint64_t generation;
+   int mode;
+
+   if (handle->category == adiak_control)
+      return dispatch_control(handle->name, handle->subcategory, value, type);
+   if (__atomic_load_n(&get_record_store(adiak_get_config())->thread_staging, __ATOMIC_RELAXED))
+      return stage_namevalue(handle->name, handle->category, handle->subcategory, value, type);
+
+   shard = get_record_shard(handle->hash);
+   mode = dispatch_prepare();
+   lock_acquire(&shard->lock);
+
+   if (!handle->record) {
+      handle->record = record_index_find(&shard->index, handle->name, handle->hash);
+      if (!handle->record)
+         handle->record = new_record(shard, handle->name, handle->hash);
+   }
+
+   rec = handle->record;
+   if (!rec) {
+      free_adiak_value_worker(type, value);
+      free_adiak_type(type);
+   } else {
+      update_record(shard, rec, handle->category, handle->subcategory, value, type, NULL);
+   }
+   generation = dispatch_locked(mode, rec);
+
+   lock_release(&shard->lock);
+   if (!rec)
+      return -1;
+   dispatch_record(mode, shard, rec, generation);
+   return 0;
+}
+
+int adiak_raw_update_handle(adiak_name_handle_t handle, adiak_value_t *value, adiak_datatype_t *type)
+{
+   int result;
+
+   if (!handle)
+      return -1;
+
+   if (handle->category != adiak_control) {
+      type = intern_datatype(type);
+      if (!type) {
+         free(value);
+         return -1;
+      }
    }
+   result = set_handle_value(handle, value, type);
+   if (handle->category != adiak_control)
+      free(value);
+   return result;
+}
+
+int adiak_update_handle(adiak_name_handle_t handle, ...)
+{
+   va_list ap;
+   adiak_datatype_t *t;
+   adiak_value_t value;
+   int result;
+
+   if (!handle || !handle->typestr)
+      return -1;
+
+   va_start(ap, handle);
+   result = make_value_from_args(handle->typestr, handle->toptype, handle->dtype, &ap, 0, &value, &t);
+   va_end(ap);
+   if (result != 0)
+      return -1;
 
-   return adiak_raw_namevalue(name, category, subcategory, value, t);
+   return set_handle_value(handle, &value, t);
 }
 
 adiak_numerical_t adiak_numerical_from_type(adiak_type_t dtype)
@@ -276,42 +1487,211 @@ adiak_numerical_t adiak_numerical_from_type(adiak_type_t dtype)
 void adiak_register_cb(int adiak_version, int category,
                        adiak_nameval_cb_t nv, int report_on_all_ranks, void *opaque_val)
 {
-   adiak_register(adiak_version, category, nv, NULL, report_on_all_ranks, opaque_val);
+   adiak_register(adiak_version, category, nv, NULL, NULL, 0, NULL, report_on_all_ranks, opaque_val);
 }
 
 void adiak_register_cb_with_info(int adiak_version, int category,
                                  adiak_nameval_info_cb_t nv, int report_on_all_ranks, void *opaque_val)
 {
-   adiak_register(adiak_version, category, NULL, nv, report_on_all_ranks, opaque_val);
+   adiak_register(adiak_version, category, NULL, nv, NULL, 0, NULL, report_on_all_ranks, opaque_val);
 }
 
-void adiak_list_namevals(int adiak_version, int category, adiak_nameval_cb_t nv, void *opaque_val)
+void adiak_register_batch_cb(int adiak_version, int category, adiak_batch_cb_t cb, int batch_size,
+                             int report_on_all_ranks, void *opaque_val)
+{
+   adiak_register(adiak_version, category, NULL, NULL, cb, batch_size, NULL, report_on_all_ranks, opaque_val);
+}
+
+void adiak_register_cb_filtered(int adiak_version, int category, const char *names, const char *subcategories,
+                                adiak_nameval_cb_t nv, int report_on_all_ranks, void *opaque_val)
+{
+   tool_filter_t *filter = new_tool_filter(names, subcategories);
+   if (filter)
+      adiak_register(adiak_version, category, nv, NULL, NULL, 0, filter, report_on_all_ranks, opaque_val);
+}
+
+void adiak_register_cb_with_info_filtered(int adiak_version, int category, const char *names,
+                                          const char *subcategories, adiak_nameval_info_cb_t nv,
+                                          int report_on_all_ranks, void *opaque_val)
+{
+   tool_filter_t *filter = new_tool_filter(names, subcategories);
+   if (filter)
+      adiak_register(adiak_version, category, NULL, nv, NULL, 0, filter, report_on_all_ranks, opaque_val);
+}
+
+/* Records are listed in insertion order from the record table. If an older
+   library copy shares adiak_public, its records are on the shared record
+   list, which is walked afterwards. Records of this library are never put
+   on the shared list, since older copies would free them in adiak_clean,
+   so older copies don't see them; mixing library versions is not
+   supported.
+
+   List callbacks are tool callbacks and run under the tool lock. Each
+   record is reported while holding its shard lock. Callers with an
+   adiak_version older than PACKED_VALUES_VERSION get packed values
+   unpacked, and miss the ones that can't be unpacked.
+ */
+static void list_record(record_list_t *rec, int category, int adiak_version,
+                        adiak_nameval_cb_t nv, adiak_nameval_info_cb_t nvi, void *opaque_val)
+{
+   record_shard_t *shard;
+   unpacked_value_t unpacked;
+   adiak_datatype_t *dtype;
+   adiak_value_t *value;
+
+   shard = get_record_shard(strhash(rec->name));
+   lock_acquire(&shard->lock);
+   /* the category can change, too */
+   if (category != adiak_category_all && rec->category != category)
+      goto done;
+
+   dtype = rec->dtype;
+   value = rec->value;
+   unpacked.type = NULL;
+   if (dtype->is_reference == PACKED_REFERENCE && adiak_version < PACKED_VALUES_VERSION) {
+      if (unpack_value(dtype, value, &unpacked) != 0)
+         goto done;
+      dtype = unpacked.type;
+      value = &unpacked.value;
+   }
+
+   if (nv)
+      nv(rec->name, rec->category, rec->subcategory, value, dtype, opaque_val);
+   else
+      nvi(rec->name, value, dtype, rec->info, opaque_val);
+   free_unpacked_value(&unpacked);
+
+done:
+   lock_release(&shard->lock);
+}
+
+static void list_records(int category, int adiak_version, adiak_nameval_cb_t nv, adiak_nameval_info_cb_t nvi,
+                         void *opaque_val)
 {
+   adiak_t* adiak_config = adiak_get_config();
+   record_store_t* store = get_record_store(adiak_config);
    record_list_t *i;
+   size_t n, count;
+
+   lock_acquire(&store->tool_lock);
+   if (category != adiak_category_all) {
+      size_t *positions = category_index_snapshot(category, &count);
+      for (n = 0; n < count; ++n) {
+         i = record_table_get(&store->table, positions[n]);
+         if (i)
+            list_record(i, category, adiak_version, nv, nvi, opaque_val);
+      }
+      free(positions);
+   } else {
+      count = __atomic_load_n(&store->table.count, __ATOMIC_ACQUIRE);
+      for (n = 0; n < count; ++n) {
+         i = record_table_get(&store->table, n);
+         if (i)
+            list_record(i, category, adiak_version, nv, nvi, opaque_val);
+      }
+   }
+   for (i = record_list_head(adiak_config); i != NULL; i = i->list_next)
+      list_record(i, category, adiak_version, nv, nvi, opaque_val);
+   lock_release(&store->tool_lock);
+}
+
+int adiak_count_namevals(int category)
+{
    adiak_t* adiak_config = adiak_get_config();
-   for (i = adiak_config->shared_record_list; i != NULL; i = i->list_next) {
-      if (category != adiak_category_all && i->category != category)
-         continue;
-      nv(i->name, i->category, i->subcategory, i->value, i->dtype, opaque_val);
+   record_store_t* store = get_record_store(adiak_config);
+   category_entry_t* entry;
+   record_list_t* i;
+   size_t count = 0;
+
+   for (i = record_list_head(adiak_config); i != NULL; i = i->list_next)
+      if (category == adiak_category_all || i->category == category)
+         ++count;
+
+   if (category == adiak_category_all) {
+      lock_acquire(&store->categories.lock);
+      for (size_t n = 0; n < store->categories.capacity; ++n)
+         count += store->categories.entries[n].count;
+      lock_release(&store->categories.lock);
+   } else {
+      lock_acquire(&store->categories.lock);
+      entry = category_index_find(&store->categories, category, 0);
+      count += entry ? entry->count : 0;
+      lock_release(&store->categories.lock);
    }
-   (void) adiak_version;
+
+   return (int) count;
+}
+
+void adiak_list_namevals(int adiak_version, int category, adiak_nameval_cb_t nv, void *opaque_val)
+{
+   list_records(category, adiak_version, nv, NULL, opaque_val);
 }
 
 void adiak_list_namevals_with_info(int adiak_version, int category, adiak_nameval_info_cb_t nv, void *opaque_val)
 {
-   record_list_t *i;
-   adiak_t* adiak_config = adiak_get_config();
-   for (i = adiak_config->shared_record_list; i != NULL; i = i->list_next) {
-      if (category != adiak_category_all && i->category != category)
-         continue;
-      nv(i->name, i->value, i->dtype, i->info, opaque_val);
+   list_records(category, adiak_version, NULL, nv, opaque_val);
+}
+
+/* Records updated after generation, each once, in the order of their latest
+   update. Falls back to scanning the record table if the change log is
+   incomplete. Records of older library copies on the shared record list
+   have no generations and are not listed; mixing library versions is not
+   supported.
+ */
+static uint64_t list_records_since(int category, int adiak_version, uint64_t generation, adiak_nameval_cb_t nv,
+                                   adiak_nameval_info_cb_t nvi, void *opaque_val)
+{
+   record_store_t* store = get_record_store(adiak_get_config());
+   change_entry_t *entries;
+   record_list_t *rec;
+   uint64_t current;
+   size_t n, count;
+
+   lock_acquire(&store->tool_lock);
+   current = __atomic_load_n(&store->generation, __ATOMIC_ACQUIRE);
+   count = changes_since(generation, current, &entries);
+   if (count != (size_t) -1) {
+      /* skip stale entries; records updated after current are listed next time */
+      for (n = 0; n < count; ++n) {
+         rec = record_table_get(&store->table, entries[n].position);
+         if (rec && record_generation(rec) == entries[n].generation)
+            list_record(rec, category, adiak_version, nv, nvi, opaque_val);
+      }
+      free(entries);
+   } else {
+      count = __atomic_load_n(&store->table.count, __ATOMIC_ACQUIRE);
+      for (n = 0; n < count; ++n) {
+         rec = record_table_get(&store->table, n);
+         if (rec && record_generation(rec) > generation && record_generation(rec) <= current)
+            list_record(rec, category, adiak_version, nv, nvi, opaque_val);
+      }
    }
-   (void) adiak_version;
+   lock_release(&store->tool_lock);
+   return current;
+}
+
+unsigned long long adiak_list_namevals_since(int adiak_version, int category, unsigned long long generation,
+                                             adiak_nameval_cb_t nv, void *opaque_val)
+{
+   return list_records_since(category, adiak_version, generation, nv, NULL, opaque_val);
+}
+
+unsigned long long adiak_list_namevals_since_with_info(int adiak_version, int category,
+                                                       unsigned long long generation,
+                                                       adiak_nameval_info_cb_t nv, void *opaque_val)
+{
+   return list_records_since(category, adiak_version, generation, NULL, nv, opaque_val);
 }
 
 int adiak_get_nameval(const char *name, adiak_datatype_t **t, adiak_value_t **value,  int *cat, const char **subcat)
 {
-   record_list_t *i = find_record_by_name(name);
+   uint64_t hashval = strhash(name);
+   record_shard_t *shard = get_record_shard(hashval);
+   record_list_t *i;
+   int result = -1;
+
+   lock_acquire(&shard->lock);
+   i = record_index_find(&shard->index, name, hashval);
    if (i != NULL) {
       if (t)
          *t = i->dtype;
@@ -321,14 +1701,21 @@ int adiak_get_nameval(const char *name, adiak_datatype_t **t, adiak_value_t **va
          *cat = i->category;
       if (subcat)
          *subcat = i->subcategory;
-      return 0;
+      result = 0;
    }
-   return -1;
+   lock_release(&shard->lock);
+   return result;
 }
 
 int adiak_get_nameval_with_info(const char *name, adiak_datatype_t **t, adiak_value_t **value,  adiak_record_info_t **info)
 {
-   record_list_t* i = find_record_by_name(name);
+   uint64_t hashval = strhash(name);
+   record_shard_t *shard = get_record_shard(hashval);
+   record_list_t *i;
+   int result = -1;
+
+   lock_acquire(&shard->lock);
+   i = record_index_find(&shard->index, name, hashval);
    if (i != NULL) {
       if (t)
          *t = i->dtype;
@@ -336,9 +1723,40 @@ int adiak_get_nameval_with_info(const char *name, adiak_datatype_t **t, adiak_va
          *value = i->value;
       if (info)
          *info = i->info;
-      return 0;
+      result = 0;
    }
-   return -1;
+   lock_release(&shard->lock);
+   return result;
+}
+
+const char *adiak_intern_string(const char *str)
+{
+   if (!str)
+      return NULL;
+   return intern_string(str);
+}
+
+void adiak_get_string_pool_stats(size_t *num_strings, size_t *bytes_used, size_t *bytes_saved)
+{
+   record_store_t* store = get_record_store(adiak_get_config());
+   size_t count = 0, used = 0, saved = 0;
+   int i;
+
+   for (i = 0; i < STRING_SHARDS; ++i) {
+      string_shard_t* shard = &store->strings[i];
+      lock_acquire(&shard->lock);
+      count += shard->pool.count;
+      used += shard->pool.bytes_used;
+      saved += shard->pool.bytes_saved;
+      lock_release(&shard->lock);
+   }
+
+   if (num_strings)
+      *num_strings = count;
+   if (bytes_used)
+      *bytes_used = used;
+   if (bytes_saved)
+      *bytes_saved = saved;
 }
 
 int adiak_num_subvals(adiak_datatype_t* t)
@@ -346,6 +1764,60 @@ int adiak_num_subvals(adiak_datatype_t* t)
    return t->num_elements + t->num_ref_elements;
 }
 
+/* Read the zero-copy element of type t at ptr into v */
+static int read_ref_value(adiak_datatype_t *t, unsigned char *ptr, adiak_value_t *v)
+{
+   switch (t->dtype) {
+      case adiak_type_unset:
+         v->v_ptr = NULL;
+         return -1;
+      case adiak_long:
+      case adiak_ulong:
+      case adiak_date:
+         v->v_long = *((long *) ptr);
+         break;
+      case adiak_longlong:
+      case adiak_ulonglong:
+         v->v_longlong = *((long long *) ptr);
+         break;
+      case adiak_int:
+      case adiak_uint:
+         switch (t->num_bytes) {
+         case 1:
+            v->v_int = *((int8_t *) ptr);
+            break;
+         case 2:
+            v->v_int = *((int16_t *) ptr);
+            break;
+         default:
+            v->v_int = *((int *) ptr);
+         }
+         break;
+      case adiak_double:
+         if (t->num_bytes == 4)
+            v->v_double = *((float *) ptr);
+         else
+            v->v_double = *((double *) ptr);
+         break;
+      case adiak_timeval:
+      case adiak_version:
+      case adiak_string:
+      case adiak_catstring:
+      case adiak_jsonstring:
+      case adiak_path:
+         v->v_ptr = *((void**) ptr);
+         break;
+      case adiak_range:
+      case adiak_set:
+      case adiak_list:
+      case adiak_tuple:
+         v->v_ptr = (void*) ptr;
+         break;
+   }
+
+   return 0;
+}
+
 int adiak_get_subval(adiak_datatype_t* t, adiak_value_t* val, int elem, adiak_datatype_t** subtype, adiak_value_t* subval)
 {
    /* Return if this is not a container type or we're out-of-bounds. */
@@ -370,9 +1842,16 @@ int adiak_get_subval(adiak_datatype_t* t, adiak_value_t* val, int elem, adiak_da
    if (elem >= t->num_ref_elements)
       goto error;
 
-   /* Compute offset of the selected subvalue. */
+   /* Compute offset of the selected subvalue. Shared datatypes have
+      precomputed offsets; others are summed up here. */
    int bytes = 0;
-   if (t->dtype == adiak_tuple) {
+   if (is_shared_type(t)) {
+      shared_type_t *shared = (shared_type_t *) t;
+      bytes = (shared->offsets ? shared->offsets[elem] : elem * shared->stride);
+      if (bytes < 0 || (!shared->offsets && shared->stride < 0))
+         goto error;
+      *subtype = t->subtype[t->dtype == adiak_tuple ? elem : 0];
+   } else if (t->dtype == adiak_tuple) {
       for (int n = 0; n < elem; ++n) {
          int s = calc_size(t->subtype[n]);
          if (s < 0)
@@ -389,55 +1868,7 @@ int adiak_get_subval(adiak_datatype_t* t, adiak_value_t* val, int elem, adiak_da
 
    unsigned char* ptr = ((unsigned char*) val->v_ptr) + bytes;
 
-   switch ((*subtype)->dtype) {
-      case adiak_type_unset:
-         (*subval).v_ptr = NULL;
-         return -1;
-      case adiak_long:
-      case adiak_ulong:
-      case adiak_date:
-         (*subval).v_long = *((long *) ptr);
-         break;
-      case adiak_longlong:
-      case adiak_ulonglong:
-         (*subval).v_longlong = *((long long *) ptr);
-         break;
-      case adiak_int:
-      case adiak_uint:
-         switch ((*subtype)->num_bytes) {
-         case 1:
-            (*subval).v_int = *((int8_t *) ptr);
-            break;
-         case 2:
-            (*subval).v_int = *((int16_t *) ptr);
-            break;
-         default:
-            (*subval).v_int = *((int *) ptr);
-         }
-         break;
-      case adiak_double:
-         if ((*subtype)->num_bytes == 4)
-            (*subval).v_double = *((float *) ptr);
-         else
-            (*subval).v_double = *((double *) ptr);
-         break;
-      case adiak_timeval:
-      case adiak_version:
-      case adiak_string:
-      case adiak_catstring:
-      case adiak_jsonstring:
-      case adiak_path:
-         (*subval).v_ptr = *((void**) ptr);
-         break;
-      case adiak_range:
-      case adiak_set:
-      case adiak_list:
-      case adiak_tuple:
-         (*subval).v_ptr = (void*) ptr;
-         break;
-   }
-
-   return 0;
+   return read_ref_value(*subtype, ptr, subval);
 
 error:
    *subtype = NULL;
@@ -445,30 +1876,100 @@ error:
    return -1;
 }
 
-static adiak_t* adiak_get_config()
+int adiak_get_array(adiak_datatype_t *t, adiak_value_t *val, void **ptr, int *count, adiak_datatype_t **elem_type)
 {
-   static adiak_t* adiak_config = NULL;
-   static adiak_tool_t* local_tool_list = NULL;
-
-   if (adiak_config)
-      return adiak_config;
-
-   adiak_config = (adiak_t *) adksys_get_public_adiak_symbol();
-   if (!adiak_config)
-      adiak_config = &adiak_public;
-   if (ADIAK_T_VERSION < adiak_config->minimum_version)
-      adiak_config->minimum_version = ADIAK_T_VERSION;
-   if (!adiak_config->tool_list)
-      adiak_config->tool_list = &local_tool_list;
+   if (!t || !val || !t->is_reference || t->dtype == adiak_tuple || is_basetype(t->dtype)
+       || !is_numeric_basetype(t->subtype[0]->dtype))
+      return -1;
 
-   return adiak_config;
+   if (ptr)
+      *ptr = val->v_ptr;
+   if (count)
+      *count = t->num_ref_elements;
+   if (elem_type)
+      *elem_type = t->subtype[0];
+   return 0;
 }
 
-void adiak_init(void *mpi_communicator_p)
+int adiak_foreach_subval(adiak_datatype_t *t, adiak_value_t *val, adiak_subval_cb_t cb, void *opaque)
 {
-   static int initialized = 0;
-   if (initialized)
-      return;
+   adiak_datatype_t *subtype;
+   adiak_value_t subval;
+   shared_type_t *shared = NULL;
+   unsigned char *ptr;
+   int i, n, result, stride = 0, offset = 0;
+
+   if (!t || !val || !cb || is_basetype(t->dtype))
+      return -1;
+
+   /* Adiak-owned data: pass the subvalues in place */
+   if (!t->is_reference) {
+      for (i = 0; i < t->num_elements; i++) {
+         subtype = t->subtype[t->dtype == adiak_tuple ? i : 0];
+         result = cb(i, subtype, val->v_subval + i, opaque);
+         if (result != 0)
+            return result;
+      }
+      return 0;
+   }
+
+   /* Zero-copy data: find the element layout once, then decode in order */
+   if (is_shared_type(t))
+      shared = (shared_type_t *) t;
+   if (t->dtype != adiak_tuple) {
+      stride = (shared ? shared->stride : calc_size(t->subtype[0]));
+      if (stride < 0)
+         return -1;
+   }
+
+   ptr = (unsigned char *) val->v_ptr;
+   for (i = 0; i < t->num_ref_elements; i++) {
+      if (t->dtype == adiak_tuple) {
+         subtype = t->subtype[i];
+         if (shared)
+            offset = shared->offsets[i];
+         if (offset < 0 || read_ref_value(subtype, ptr + offset, &subval) == -1)
+            return -1;
+         if (!shared) {
+            n = calc_size(subtype);
+            offset = (n < 0 ? -1 : offset + n);
+         }
+      } else {
+         subtype = t->subtype[0];
+         if (read_ref_value(subtype, ptr + (size_t) i * stride, &subval) == -1)
+            return -1;
+      }
+      result = cb(i, subtype, &subval, opaque);
+      if (result != 0)
+         return result;
+   }
+   return 0;
+}
+
+static adiak_t* adiak_get_config()
+{
+   static adiak_t* adiak_config = NULL;
+   static adiak_tool_t* local_tool_list = NULL;
+
+   if (adiak_config)
+      return adiak_config;
+
+   adiak_config = (adiak_t *) adksys_get_public_adiak_symbol();
+   if (!adiak_config)
+      adiak_config = &adiak_public;
+   if (ADIAK_T_VERSION < adiak_config->minimum_version)
+      adiak_config->minimum_version = ADIAK_T_VERSION;
+   if (!adiak_config->tool_list)
+      adiak_config->tool_list = &local_tool_list;
+
+   return adiak_config;
+}
+
+void adiak_init(void *mpi_communicator_p)
+{
+   static int initialized = 0;
+   if (initialized)
+      return;
    initialized = 1;
 
    adiak_t* adiak_config = adiak_get_config();
@@ -499,6 +2000,8 @@ void adiak_fini()
       measure_systime();
    if (measure_adiak_walltime)
       measure_walltime();
+   adiak_sync();
+   async_stop(get_record_store(adiak_get_config()));
 
    val.v_int = 0;
    adiak_raw_namevalue("fini", adiak_control, NULL, &val, &base_int);
@@ -507,57 +2010,692 @@ void adiak_fini()
 static void adiak_register(int adiak_version, int category,
                            adiak_nameval_cb_t nv,
                            adiak_nameval_info_cb_t nvi,
+                           adiak_batch_cb_t bcb, int batch_size, tool_filter_t *filter,
                            int report_on_all_ranks, void *opaque_val)
 {
    adiak_tool_t *newtool;
    adiak_t* adiak_config = adiak_get_config();
    adiak_tool_t** tool_list = adiak_config->tool_list;
+   adiak_lock_t* tool_lock = &get_record_store(adiak_config)->tool_lock;
 
    newtool = (adiak_tool_t *) malloc(sizeof(adiak_tool_t));
+   if (!newtool) {
+      free_tool_filter(filter);
+      return;
+   }
    memset(newtool, 0, sizeof(*newtool));
-   newtool->version = adiak_version;
+   newtool->version = adiak_version | TOOL_EXTENDED_LAYOUT;
    newtool->opaque_val = opaque_val;
    newtool->report_on_all_ranks = report_on_all_ranks;
    newtool->name_val_cb = nv;
    newtool->nameval_info_cb = nvi;
    newtool->category = category;
-   newtool->next = *tool_list;
    newtool->prev = NULL;
+   newtool->filter = filter;
+   if (bcb) {
+      newtool->batch = (tool_batch_t *) calloc(1, sizeof(tool_batch_t));
+      if (!newtool->batch) {
+         free(newtool);
+         return;
+      }
+      newtool->batch_cb = bcb;
+      newtool->batch_size = batch_size > 0 ? batch_size : 0;
+   }
 
+   lock_acquire(tool_lock);
+   newtool->next = *tool_list;
    if (*tool_list)
       (*tool_list)->prev = newtool;
-   *tool_list = newtool;
+   __atomic_store_n(tool_list, newtool, __ATOMIC_RELEASE);
+   lock_release(tool_lock);
+
+   if (adiak_version >= PACKED_VALUES_VERSION)
+      __atomic_store_n(&get_record_store(adiak_config)->packed_values, 1, __ATOMIC_RELEASE);
 
    if (report_on_all_ranks && !adiak_config->report_on_all_ranks)
       adiak_config->report_on_all_ranks = 1;
 }
 
-static int find_end_brace(const char *typestr, char endchar, int typestr_start, int typestr_end) {
-   int depth = 0;
-   int cur = typestr_start;
+static void free_tool(adiak_tool_t *tool)
+{
+   tool_batch_t *batch;
+   if (has_extended_layout(tool)) {
+      batch = tool->batch;
+      if (batch) {
+         free(batch->records);
+         free(batch->pending);
+         free(batch->entries);
+         free(batch);
+      }
+      free_tool_filter(tool->filter);
+   }
+   free(tool);
+}
+
+static void free_tool_filter(tool_filter_t *filter)
+{
+   if (!filter)
+      return;
+   free(filter->names);
+   free(filter->subcategories);
+   free(filter->patterns);
+   free(filter);
+}
 
-   if (!typestr)
+/* Split list at commas in place, skipping empty items. Returns the number
+   of items, or -1 if items can't be allocated.
+ */
+static int split_filter_list(char *list, char ***items)
+{
+   int n = 1, count = 0;
+   char *p, *item;
+
+   *items = NULL;
+   if (!list)
+      return 0;
+   for (p = list; *p; ++p)
+      if (*p == ',')
+         ++n;
+   *items = (char **) malloc(n * sizeof(char *));
+   if (!*items)
       return -1;
 
-   while (cur < typestr_end) {
-      if (typestr[cur] == '[' || typestr[cur] == '{' || typestr[cur] == '(' || typestr[cur] == '<')
-         depth++;
-      if (typestr[cur] == ']' || typestr[cur] == '}' || typestr[cur] == ')' || typestr[cur] == '>')
-         depth--;
-      if (depth == 0 && typestr[cur] == endchar)
-         return cur;
-      cur++;
+   for (item = p = list; ; ++p) {
+      if (*p != ',' && *p != '\0')
+         continue;
+      if (p > item)
+         (*items)[count++] = item;
+      if (*p == '\0')
+         break;
+      *p = '\0';
+      item = p + 1;
    }
-   return -1;
+   return count;
+}
+
+static tool_filter_t *new_tool_filter(const char *names, const char *subcategories)
+{
+   tool_filter_t *filter = (tool_filter_t *) calloc(1, sizeof(tool_filter_t));
+   char *subcategory_list = subcategories ? strdup(subcategories) : NULL;
+   char **items = NULL, *wildcard;
+   int i, n;
+
+   if (!filter || (names && !(filter->patterns = strdup(names))) || (subcategories && !subcategory_list))
+      goto error;
+
+   n = split_filter_list(filter->patterns, &items);
+   if (n < 0)
+      goto error;
+   if (n > 0) {
+      filter->names = (name_pattern_t *) malloc(n * sizeof(name_pattern_t));
+      if (!filter->names) {
+         free(items);
+         goto error;
+      }
+   }
+   for (i = 0; i < n; ++i) {
+      name_pattern_t *pattern = filter->names + filter->num_names++;
+      pattern->len = strlen(items[i]);
+      wildcard = strpbrk(items[i], "*?");
+      if (!wildcard) {
+         pattern->kind = NAME_PATTERN_EXACT;
+         pattern->pattern = intern_string(items[i]);
+      } else if (wildcard == items[i] + pattern->len - 1 && *wildcard == '*') {
+         pattern->kind = NAME_PATTERN_PREFIX;
+         pattern->pattern = items[i];
+         pattern->len -= 1;
+      } else {
+         pattern->kind = NAME_PATTERN_GLOB;
+         pattern->pattern = items[i];
+      }
+   }
+   free(items);
+
+   n = split_filter_list(subcategory_list, &items);
+   if (n < 0)
+      goto error;
+   filter->subcategories = (const char **) items;
+   for (i = 0; i < n; ++i)
+      filter->subcategories[i] = intern_string(items[i]);
+   filter->num_subcategories = n;
+   free(subcategory_list);
+   return filter;
+
+error:
+   free(subcategory_list);
+   free_tool_filter(filter);
+   return NULL;
+}
+
+/* Match str against a glob with '*' and '?' wildcards */
+static int glob_match(const char *pattern, const char *str)
+{
+   const char *star = NULL, *retry = NULL;
+
+   while (*str) {
+      if (*pattern == '*') {
+         star = ++pattern;
+         retry = str;
+      } else if (*pattern == '?' || *pattern == *str) {
+         ++pattern;
+         ++str;
+      } else if (star) {
+         pattern = star;
+         str = ++retry;
+      } else {
+         return 0;
+      }
+   }
+   while (*pattern == '*')
+      ++pattern;
+   return *pattern == '\0';
+}
+
+/* Check a record's name and subcategory against filter. Both are
+   interned, so exact matches compare pointers.
+ */
+static int tool_filter_matches(tool_filter_t *filter, const char *name, const char *subcategory)
+{
+   int i, matched = filter->num_names == 0;
+
+   for (i = 0; i < filter->num_names && !matched; ++i) {
+      name_pattern_t *pattern = filter->names + i;
+      switch (pattern->kind) {
+         case NAME_PATTERN_EXACT:
+            matched = name == pattern->pattern;
+            break;
+         case NAME_PATTERN_PREFIX:
+            matched = strncmp(name, pattern->pattern, pattern->len) == 0;
+            break;
+         default:
+            matched = glob_match(pattern->pattern, name);
+      }
+   }
+   if (!matched || filter->num_subcategories == 0)
+      return matched;
+
+   for (i = 0; i < filter->num_subcategories; ++i)
+      if (subcategory == filter->subcategories[i])
+         return 1;
+   return 0;
+}
+
+static uint64_t type_cache_hash(const char *typestr, const int *counts, int num_counts)
+{
+   uint64_t hash = strhash(typestr);
+   int i;
+   for (i = 0; i < num_counts; ++i)
+      hash = strhash_mix(hash ^ ((uint64_t) (unsigned) counts[i] * 0x9e3779b97f4a7c15ULL));
+   return hash;
+}
+
+static size_t type_cache_ptr_hash(const adiak_datatype_t *t)
+{
+   return (size_t) strhash_mix((uint64_t) (uintptr_t) t);
+}
+
+static int type_cache_match(const type_cache_entry_t *e, const type_cache_entry_t *key)
+{
+   if (e->hash != key->hash || e->num_counts != key->num_counts ||
+       memcmp(e->counts, key->counts, key->num_counts * sizeof(int)) != 0)
+      return 0;
+   if (e->typestr && key->typestr)
+      return strcmp(e->typestr, key->typestr) == 0;
+   if (e->typestr || key->typestr)
+      return 0;
+   /* structural entries: counts[2] is the number of subtypes */
+   return memcmp(e->subtypes, key->subtypes, key->counts[2] * sizeof(adiak_datatype_t *)) == 0;
+}
+
+/* Callers hold the cache lock */
+static adiak_datatype_t* type_cache_find(type_cache_t *cache, const type_cache_entry_t *key)
+{
+   size_t mask, pos;
+
+   if (cache->capacity == 0)
+      return NULL;
+
+   mask = cache->capacity - 1;
+   for (pos = key->hash & mask; cache->entries[pos].type != NULL; pos = (pos + 1) & mask)
+      if (type_cache_match(cache->entries + pos, key))
+         return cache->entries[pos].type;
+   return NULL;
+}
+
+static void type_cache_place(type_cache_entry_t *entries, adiak_datatype_t **types, size_t capacity,
+                             const type_cache_entry_t *entry)
+{
+   size_t mask = capacity - 1, pos;
+
+   for (pos = entry->hash & mask; entries[pos].type != NULL; pos = (pos + 1) & mask)
+      ;
+   entries[pos] = *entry;
+   if (entry->typestr)
+      return;
+   for (pos = type_cache_ptr_hash(entry->type) & mask; types[pos] != NULL; pos = (pos + 1) & mask)
+      ;
+   types[pos] = entry->type;
+}
+
+static int type_cache_grow(type_cache_t *cache)
+{
+   size_t capacity = cache->capacity ? cache->capacity * 2 : TYPE_CACHE_MIN_CAPACITY;
+   type_cache_entry_t *entries;
+   adiak_datatype_t **types;
+   size_t i;
+
+   entries = (type_cache_entry_t *) calloc(capacity, sizeof(type_cache_entry_t));
+   types = (adiak_datatype_t **) calloc(capacity, sizeof(adiak_datatype_t *));
+   if (!entries || !types) {
+      free(entries);
+      free(types);
+      return -1;
+   }
+
+   for (i = 0; i < cache->capacity; ++i)
+      if (cache->entries[i].type)
+         type_cache_place(entries, types, capacity, cache->entries + i);
+
+   free(cache->entries);
+   free(cache->types);
+   cache->entries = entries;
+   cache->types = types;
+   cache->capacity = capacity;
+   return 0;
+}
+
+/* Insert entry unless an equal entry exists. Returns the cached datatype,
+   or NULL if the cache is full. Callers hold the cache lock. */
+static adiak_datatype_t* type_cache_insert(type_cache_t *cache, const type_cache_entry_t *entry)
+{
+   adiak_datatype_t *found = type_cache_find(cache, entry);
+   if (found)
+      return found;
+   if (cache->count >= TYPE_CACHE_MAX_ENTRIES)
+      return NULL;
+   if ((cache->count + 1) * 100 > cache->capacity * RECORD_INDEX_MAX_LOAD && type_cache_grow(cache) != 0)
+      return NULL;
+   type_cache_place(cache->entries, cache->types, cache->capacity, entry);
+   cache->count++;
+   return entry->type;
+}
+
+static int type_cache_contains(adiak_datatype_t *t)
+{
+   type_cache_t *cache = &get_record_store(adiak_get_config())->types;
+   size_t mask, pos;
+   int found = 0;
+
+   lock_acquire(&cache->lock);
+   if (cache->capacity > 0) {
+      mask = cache->capacity - 1;
+      for (pos = type_cache_ptr_hash(t) & mask; cache->types[pos] != NULL; pos = (pos + 1) & mask)
+         if (cache->types[pos] == t) {
+            found = 1;
+            break;
+         }
+   }
+   lock_release(&cache->lock);
+   return found;
+}
+
+/* Whether t is a base type or a node from the type cache. Datatypes of this
+   library are shared or private nodes, which record this. If an older
+   library copy shares adiak_public, t may come from that copy, so the cache
+   is searched instead.
+ */
+static int is_shared_type(adiak_datatype_t *t)
+{
+   if (is_basetype(t->dtype))
+      return 1;
+   if (adiak_get_config()->minimum_version >= 3)
+      return ((shared_type_t *) t)->is_shared;
+   return type_cache_contains(t);
+}
+
+static void type_cache_clear(type_cache_t *cache)
+{
+   size_t i;
+   /* type string entries point to nodes owned by structural entries */
+   for (i = 0; i < cache->capacity; ++i) {
+      if (cache->entries[i].type == NULL || cache->entries[i].typestr)
+         continue;
+      free((shared_type_t *) cache->entries[i].type);
+   }
+   free(cache->entries);
+   free(cache->types);
+   cache->entries = NULL;
+   cache->types = NULL;
+   cache->capacity = 0;
+   cache->count = 0;
+}
+
+static void type_cache_node_key(type_cache_entry_t *entry, adiak_datatype_t *t)
+{
+   int i;
+
+   memset(entry, 0, sizeof(*entry));
+   entry->num_counts = 7;
+   entry->counts[0] = (int) t->dtype;
+   entry->counts[1] = t->num_elements;
+   entry->counts[2] = t->num_subtypes;
+   entry->counts[3] = t->is_reference;
+   entry->counts[4] = t->num_ref_elements;
+   entry->counts[5] = (int) t->numerical;
+   entry->counts[6] = (int) t->num_bytes;
+   entry->subtypes = t->subtype;
+   entry->hash = type_cache_hash("", entry->counts, entry->num_counts);
+   for (i = 0; i < t->num_subtypes; ++i)
+      entry->hash = strhash_mix(entry->hash ^ (uint64_t) (uintptr_t) t->subtype[i]);
+}
+
+static const adiak_flat_type_t *base_flat_type(adiak_datatype_t *t)
+{
+   size_t i;
+   for (i = 0; i < sizeof(base_flat_types) / sizeof(base_flat_types[0]); ++i)
+      if (base_flat_types[i].type == t)
+         return base_flat_types + i;
+   return NULL;
+}
+
+const adiak_flat_type_t *adiak_get_flat_type(adiak_datatype_t *t, int *num_nodes)
+{
+   const adiak_flat_type_t *flat = NULL;
+   int n = 0;
+
+   if (t && is_basetype(t->dtype)) {
+      flat = base_flat_type(t);
+      n = flat ? 1 : 0;
+   } else if (t && is_shared_type(t)) {
+      flat = ((shared_type_t *) t)->flat;
+      n = ((shared_type_t *) t)->num_flat;
+   }
+   if (num_nodes)
+      *num_nodes = n;
+   return flat;
+}
+
+int adiak_flat_subtype(const adiak_flat_type_t *flat, int node, int n)
+{
+   int i, sub;
+
+   if (!flat || n < 0 || n >= flat[node].num_subtypes)
+      return -1;
+   sub = node + 1;
+   for (i = 0; i < n; ++i)
+      sub += flat[sub].subtree_size;
+   return sub;
+}
+
+/* calc_size for a base or shared datatype, without recursing */
+static int shared_type_size(adiak_datatype_t *t)
+{
+   return is_basetype(t->dtype) ? calc_size(t) : ((shared_type_t *) t)->size;
+}
+
+/* Allocate a shared node for t, whose subtypes must be shared or base
+   types. Returns NULL if a subtype isn't.
+ */
+static shared_type_t *new_shared_type(adiak_datatype_t *t)
+{
+   const adiak_flat_type_t *subflat;
+   shared_type_t *shared;
+   adiak_flat_type_t *flat;
+   int num_flat = 1, n, i;
+
+   for (i = 0; i < t->num_subtypes; ++i) {
+      if (!adiak_get_flat_type(t->subtype[i], &n))
+         return NULL;
+      num_flat += n;
+   }
+
+   shared = (shared_type_t *) malloc(sizeof(shared_type_t) + sizeof(adiak_datatype_t *) * t->num_subtypes
+                                     + sizeof(adiak_flat_type_t) * num_flat
+                                     + (t->dtype == adiak_tuple ? sizeof(int) * t->num_subtypes : 0));
+   if (!shared)
+      return NULL;
+   shared->type = *t;
+   shared->is_shared = 1;
+   shared->type.subtype = (adiak_datatype_t **) (shared + 1);
+   memcpy(shared->type.subtype, t->subtype, sizeof(adiak_datatype_t *) * t->num_subtypes);
+   shared->num_flat = num_flat;
+   shared->flat = (adiak_flat_type_t *) (shared->type.subtype + t->num_subtypes);
+   shared->offsets = NULL;
+
+   /* subtypes are shared too, so their sizes are known */
+   if (t->dtype == adiak_tuple) {
+      shared->offsets = (int *) (shared->flat + num_flat);
+      shared->stride = 0;
+      shared->size = 0;
+      for (i = 0; i < t->num_subtypes; ++i) {
+         n = shared_type_size(t->subtype[i]);
+         shared->offsets[i] = shared->size;
+         if (shared->size >= 0)
+            shared->size = (n < 0 ? -1 : shared->size + n);
+      }
+   } else {
+      shared->stride = shared_type_size(t->subtype[0]);
+      shared->size = (shared->stride < 0 ? -1 : (t->num_elements + t->num_ref_elements) * shared->stride);
+   }
+
+   flat = shared->flat;
+   flat->dtype = t->dtype;
+   flat->num_elements = t->num_elements + t->num_ref_elements;
+   flat->is_reference = t->is_reference;
+   flat->num_subtypes = t->num_subtypes;
+   flat->subtree_size = num_flat;
+   flat->type = &shared->type;
+   flat++;
+   for (i = 0; i < t->num_subtypes; ++i) {
+      subflat = adiak_get_flat_type(t->subtype[i], &n);
+      memcpy(flat, subflat, sizeof(adiak_flat_type_t) * n);
+      flat += n;
+   }
+
+   return shared;
+}
+
+/* Allocate a private node for t with a copy of its subtype array. */
+static adiak_datatype_t *new_private_type(adiak_datatype_t *t)
+{
+   shared_type_t *node = (shared_type_t *) malloc(sizeof(shared_type_t));
+   adiak_datatype_t **subtype = NULL;
+
+   if (node && t->num_subtypes > 0)
+      subtype = (adiak_datatype_t **) malloc(sizeof(adiak_datatype_t *) * t->num_subtypes);
+   if (!node || (t->num_subtypes > 0 && !subtype)) {
+      free(node);
+      free(subtype);
+      return NULL;
+   }
+
+   memset(node, 0, sizeof(*node));
+   node->type = *t;
+   node->type.subtype = subtype;
+   if (subtype)
+      memcpy(subtype, t->subtype, sizeof(adiak_datatype_t *) * t->num_subtypes);
+   return &node->type;
+}
+
+/* Return the canonical node equal to t, whose subtypes must already be
+   canonical. If t is owned by the caller it is freed. Returns a private
+   node if t can't be shared, e.g. if the cache is full, or NULL if that
+   can't be allocated either.
+ */
+static adiak_datatype_t *intern_type_node(adiak_datatype_t *t, int is_owned)
+{
+   type_cache_t *cache = &get_record_store(adiak_get_config())->types;
+   type_cache_entry_t entry;
+   adiak_datatype_t *found, *node;
+   shared_type_t *shared;
+
+   type_cache_node_key(&entry, t);
+
+   lock_acquire(&cache->lock);
+   found = type_cache_find(cache, &entry);
+   lock_release(&cache->lock);
+
+   if (!found) {
+      shared = new_shared_type(t);
+      if (shared) {
+         entry.subtypes = shared->type.subtype;
+         entry.type = &shared->type;
+
+         lock_acquire(&cache->lock);
+         found = type_cache_insert(cache, &entry);
+         lock_release(&cache->lock);
+
+         if (found != &shared->type)
+            free(shared);
+      }
+   }
+
+   node = found ? found : new_private_type(t);
+   if (node && is_owned) {
+      free(t->subtype);
+      free(t);
+   }
+   return node;
+}
+
+/* Replace t with its canonical, shared equivalent. Takes ownership of t,
+   which may have been built by the caller, so it is looked up in the
+   cache. Returns NULL if a node can't be allocated.
+ */
+static adiak_datatype_t *intern_datatype(adiak_datatype_t *t)
+{
+   int i;
+
+   if (t == NULL || is_basetype(t->dtype) || type_cache_contains(t))
+      return t;
+   for (i = 0; i < t->num_subtypes; ++i) {
+      t->subtype[i] = intern_datatype(t->subtype[i]);
+      if (!t->subtype[i])
+         return NULL;
+   }
+   return intern_type_node(t, 1);
+}
+
+static __thread const char *typestr_error;
+static __thread int typestr_error_pos;
+
+static void set_typestr_error(const typestr_parser_t *p)
+{
+   typestr_error = p ? p->error : NULL;
+   typestr_error_pos = p ? p->error_pos : 0;
+}
+
+const char *adiak_get_typestr_error(int *offset)
+{
+   if (offset)
+      *offset = typestr_error_pos;
+   return typestr_error;
 }
 
+/* Parse typestr, consuming container element counts from ap. Compound
+   datatypes are canonical nodes from the type cache. Repeated type strings
+   are looked up after a pass that only reads the counts, in which case ap
+   is not advanced; callers must not read further arguments from ap.
+ */
 static adiak_datatype_t *parse_typestr(const char *typestr, va_list *ap)
 {
-   int end = 0;
-   int len;
+   type_cache_t *cache;
+   type_cache_entry_t entry;
+   typestr_parser_t p;
+   adiak_datatype_t *t = NULL, *found;
+   va_list scan_ap;
+   int result;
+
+   memset(&p, 0, sizeof(p));
+   p.str = typestr;
+   p.ap = ap;
+   p.build = 1;
+
+   if (!typestr) {
+      p.error = "no type string";
+      set_typestr_error(&p);
+      return NULL;
+   }
+
+   if (is_basetype(toplevel_type(typestr))) {
+      parse_typestr_full(&p, &t);
+      set_typestr_error(&p);
+      return t;
+   }
+
+   memset(&entry, 0, sizeof(entry));
+   va_copy(scan_ap, *ap);
+   p.ap = &scan_ap;
+   p.build = 0;
+   p.counts = entry.counts;
+   p.max_counts = TYPE_CACHE_MAX_COUNTS;
+   result = parse_typestr_full(&p, &t);
+   va_end(scan_ap);
+   set_typestr_error(&p);
+   if (result != 0)
+      return NULL;
+   entry.num_counts = p.num_counts;
+
+   cache = &get_record_store(adiak_get_config())->types;
+   if (entry.num_counts >= 0) {
+      entry.hash = type_cache_hash(typestr, entry.counts, entry.num_counts);
+      entry.typestr = typestr;
+
+      lock_acquire(&cache->lock);
+      found = type_cache_find(cache, &entry);
+      lock_release(&cache->lock);
+      if (found)
+         return found;
+   }
+
+   memset(&p, 0, sizeof(p));
+   p.str = typestr;
+   p.ap = ap;
+   p.build = 1;
+   if (parse_typestr_full(&p, &t) != 0) {
+      set_typestr_error(&p);
+      return NULL;
+   }
+
+   t = intern_datatype(t);
+   if (!t || entry.num_counts < 0 || !is_shared_type(t))
+      return t;
 
-   len = strlen(typestr);
-   return parse_typestr_helper(typestr, 0, len, 0, ap, &end);
+   entry.typestr = intern_string(typestr);
+   entry.type = t;
+   if (entry.typestr) {
+      lock_acquire(&cache->lock);
+      type_cache_insert(cache, &entry);
+      lock_release(&cache->lock);
+   }
+   return t;
+}
+
+/* Return the shared datatype of a container of num_elements values with
+   the given subtypes, for the C++ interface. The subtypes must be base
+   types or datatypes from Adiak; they are not modified. Returns NULL if a
+   subtype is not shared.
+ */
+adiak_datatype_t *adiak_get_compound_type(adiak_type_t dtype, int num_elements, int num_subtypes,
+                                          adiak_datatype_t **subtypes)
+{
+   adiak_datatype_t proto;
+   int i;
+
+   if (is_basetype(dtype) || dtype == adiak_type_unset || num_subtypes < 1 || num_elements < 0)
+      return NULL;
+   for (i = 0; i < num_subtypes; ++i)
+      if (subtypes[i] == NULL || !is_shared_type(subtypes[i]))
+         return NULL;
+
+   memset(&proto, 0, sizeof(proto));
+   proto.dtype = dtype;
+   proto.numerical = adiak_numerical_from_type(dtype);
+   proto.num_elements = num_elements;
+   proto.num_subtypes = num_subtypes;
+   proto.subtype = subtypes;
+
+   return intern_type_node(&proto, 0);
 }
 
 static adiak_type_t toplevel_type(const char *typestr) {
@@ -654,22 +2792,65 @@ static int is_basetype(adiak_type_t t)
       t == adiak_tuple);
 }
 
-static void free_adiak_type(adiak_datatype_t *t)
+static int is_numeric_basetype(adiak_type_t t)
 {
-   int i;
-   if (t == NULL)
-      return;
+   switch (t) {
+      case adiak_long:
+      case adiak_ulong:
+      case adiak_longlong:
+      case adiak_ulonglong:
+      case adiak_int:
+      case adiak_uint:
+      case adiak_double:
+      case adiak_date:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+static void free_adiak_type_tree(adiak_datatype_t *t)
+{
+   int i;
+   if (t == NULL)
+      return;
    if (is_basetype(t->dtype))
       return;
    for (i = 0; i < t->num_subtypes; i++) {
-      free_adiak_type(t->subtype[i]);
+      free_adiak_type_tree(t->subtype[i]);
    }
    if (t->num_subtypes)
       free(t->subtype);
    free(t);
 }
 
+/* Free a datatype that may contain shared nodes */
+static void free_adiak_type(adiak_datatype_t *t)
+{
+   int i;
+   if (t == NULL || is_shared_type(t))
+      return;
+   for (i = 0; i < t->num_subtypes; i++)
+      free_adiak_type(t->subtype[i]);
+   if (t->num_subtypes)
+      free(t->subtype);
+   free(t);
+}
+
 static void free_adiak_value_worker(adiak_datatype_t *t, adiak_value_t *v) {
+   if (t->is_reference) {
+      if (t->is_reference == PACKED_REFERENCE && value_block_remove(v->v_ptr))
+         free(v->v_ptr);
+      return;
+   }
+   if (!is_basetype(t->dtype) && value_block_remove(v->v_ptr)) {
+      free(v->v_ptr);
+      return;
+   }
+   free_value_tree(t, v);
+}
+
+static void free_value_tree(adiak_datatype_t *t, adiak_value_t *v) {
    int i;
    adiak_value_t *values;
 
@@ -690,24 +2871,27 @@ static void free_adiak_value_worker(adiak_datatype_t *t, adiak_value_t *v) {
       case adiak_timeval:
       case adiak_version:
       case adiak_string:
-      case adiak_catstring:
       case adiak_jsonstring:
-      case adiak_path:
          free(v->v_ptr);
          break;
+      case adiak_catstring:
+      case adiak_path:
+         if (!is_interned_string((const char *) v->v_ptr))
+            free(v->v_ptr);
+         break;
       case adiak_range:
       case adiak_set:
       case adiak_list:
          values = (adiak_value_t *) v->v_ptr;
          for (i = 0; i < t->num_elements; i++) {
-            free_adiak_value_worker(t->subtype[0], values+i);
+            free_value_tree(t->subtype[0], values+i);
          }
          free(values);
          break;
       case adiak_tuple:
          values = (adiak_value_t *) v->v_ptr;
          for (i = 0; i < t->num_elements; i++) {
-            free_adiak_value_worker(t->subtype[i], values+i);
+            free_value_tree(t->subtype[i], values+i);
          }
          free(values);
          break;
@@ -758,9 +2942,150 @@ static int calc_size(adiak_datatype_t* datatype)
    return -1;
 }
 
-static int copy_value(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr) {
+#define VALUE_BLOCK_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+/* First pass of copy_value: add the bytes needed for the deep copy of the
+   value at ptr to *value_bytes (value arrays and timevals) and
+   *string_bytes. Returns the number of bytes read from ptr, or -1.
+ */
+static int measure_value(adiak_datatype_t *datatype, void *ptr, size_t *value_bytes, size_t *string_bytes)
+{
+   int bytes_read = 0, result, type_index = 0, i;
+   unsigned char *array_base = (unsigned char *) ptr;
+
+   switch (datatype->dtype) {
+      case adiak_type_unset:
+         return -1;
+      case adiak_long:
+      case adiak_ulong:
+      case adiak_date:
+         return sizeof(long);
+      case adiak_longlong:
+      case adiak_ulonglong:
+         return sizeof(long long);
+      case adiak_int:
+      case adiak_uint:
+      case adiak_double:
+         return datatype->num_bytes;
+      case adiak_timeval:
+         if (!datatype->is_reference)
+            *value_bytes += VALUE_BLOCK_ALIGN(sizeof(struct timeval));
+         return sizeof(struct timeval *);
+      case adiak_version:
+      case adiak_string:
+      case adiak_jsonstring:
+         if (!datatype->is_reference)
+            *string_bytes += strlen(*((char **) ptr)) + 1;
+         return sizeof(char *);
+      case adiak_catstring:
+      case adiak_path:
+         /* interned, not copied into the block */
+         return sizeof(char *);
+      case adiak_range:
+      case adiak_set:
+      case adiak_list:
+      case adiak_tuple:
+         if (datatype->is_reference)
+            return calc_size(datatype);
+         *value_bytes += VALUE_BLOCK_ALIGN(sizeof(adiak_value_t) * datatype->num_elements);
+         if (datatype->dtype != adiak_tuple && is_numeric_basetype(datatype->subtype[0]->dtype))
+            return datatype->num_elements * calc_size(datatype->subtype[0]);
+         for (i = 0; i < datatype->num_elements; i++) {
+            result = measure_value(datatype->subtype[type_index], array_base + bytes_read,
+                                   value_bytes, string_bytes);
+            if (result == -1)
+               return -1;
+            bytes_read += result;
+            if (datatype->dtype == adiak_tuple)
+               type_index++;
+         }
+         return bytes_read;
+   }
+   return -1;
+}
+
+/* Widen count numeric elements of type elem at ptr into values. This is
+   the bulk path for numeric containers: the element type is dispatched
+   once, and each case is a plain loop the compiler can vectorize, or a
+   memcpy where the widths match. Returns the number of bytes read.
+ */
+static int convert_numeric_array(adiak_value_t *values, adiak_datatype_t *elem, const void *ptr, int count)
+{
+   int i;
+
+   switch (elem->dtype) {
+      case adiak_long:
+      case adiak_ulong:
+      case adiak_date:
+         if (sizeof(long) == sizeof(adiak_value_t)) {
+            memcpy(values, ptr, count * sizeof(long));
+         } else {
+            const long *src = (const long *) ptr;
+            for (i = 0; i < count; i++)
+               values[i].v_long = src[i];
+         }
+         return count * sizeof(long);
+      case adiak_longlong:
+      case adiak_ulonglong:
+         if (sizeof(long long) == sizeof(adiak_value_t)) {
+            memcpy(values, ptr, count * sizeof(long long));
+         } else {
+            const long long *src = (const long long *) ptr;
+            for (i = 0; i < count; i++)
+               values[i].v_longlong = src[i];
+         }
+         return count * sizeof(long long);
+      case adiak_int:
+      case adiak_uint:
+         switch (elem->num_bytes) {
+            case 1: {
+               const int8_t *src = (const int8_t *) ptr;
+               for (i = 0; i < count; i++)
+                  values[i].v_int = src[i];
+               break;
+            }
+            case 2: {
+               const int16_t *src = (const int16_t *) ptr;
+               for (i = 0; i < count; i++)
+                  values[i].v_int = src[i];
+               break;
+            }
+            default: {
+               const int *src = (const int *) ptr;
+               for (i = 0; i < count; i++)
+                  values[i].v_int = src[i];
+            }
+         }
+         return count * (int) elem->num_bytes;
+      case adiak_double:
+         if (elem->num_bytes == 4) {
+            const float *src = (const float *) ptr;
+            for (i = 0; i < count; i++)
+               values[i].v_double = src[i];
+         } else if (sizeof(double) == sizeof(adiak_value_t)) {
+            memcpy(values, ptr, count * sizeof(double));
+         } else {
+            const double *src = (const double *) ptr;
+            for (i = 0; i < count; i++)
+               values[i].v_double = src[i];
+         }
+         return count * (int) elem->num_bytes;
+      default:
+         return -1;
+   }
+}
+
+/* Second pass of copy_value: copy the value at ptr into target, placing
+   value arrays and timevals at *values and string bytes at *strings.
+ */
+static int copy_value_to_block(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr,
+                               unsigned char **values, char **strings)
+{
    int bytes_read = 0, result, type_index = 0, i;
+   unsigned char *array_base = (unsigned char *) ptr;
    adiak_value_t *newvalues;
+   size_t len;
+
    switch (datatype->dtype) {
       case adiak_type_unset:
          return -1;
@@ -795,21 +3120,32 @@ static int copy_value(adiak_value_t *target, adiak_datatype_t *datatype, void *p
       case adiak_timeval: {
          struct timeval* v = (struct timeval*) *((void**) ptr);
          if (!datatype->is_reference) {
-            struct timeval* tmp = malloc(sizeof(struct timeval));
-            memcpy(tmp, v, sizeof(struct timeval));
-            v = tmp;
+            memcpy(*values, v, sizeof(struct timeval));
+            v = (struct timeval *) *values;
+            *values += VALUE_BLOCK_ALIGN(sizeof(struct timeval));
          }
          target->v_ptr = v;
          return sizeof(struct timeval *);
       }
       case adiak_version:
       case adiak_string:
-      case adiak_catstring:
       case adiak_jsonstring:
+         {
+            char* sptr = (char*) *((void**) ptr);
+            if (!datatype->is_reference) {
+               len = strlen(sptr) + 1;
+               memcpy(*strings, sptr, len);
+               sptr = *strings;
+               *strings += len;
+            }
+            target->v_ptr = sptr;
+         }
+         return sizeof(char *);
+      case adiak_catstring:
       case adiak_path:
          {
             char* sptr = (char*) *((void**) ptr);
-            target->v_ptr = (datatype->is_reference ? sptr : strdup(sptr));
+            target->v_ptr = (datatype->is_reference ? sptr : copy_string_value(datatype, sptr));
          }
          return sizeof(char *);
       case adiak_range:
@@ -820,22 +3156,142 @@ static int copy_value(adiak_value_t *target, adiak_datatype_t *datatype, void *p
             target->v_ptr = ptr;
             return calc_size(datatype);
          }
-         newvalues = (adiak_value_t *) malloc(sizeof(adiak_value_t) * datatype->num_elements);
+         newvalues = (adiak_value_t *) *values;
+         *values += VALUE_BLOCK_ALIGN(sizeof(adiak_value_t) * datatype->num_elements);
+         target->v_subval = newvalues;
+         if (datatype->dtype != adiak_tuple && is_numeric_basetype(datatype->subtype[0]->dtype))
+            return convert_numeric_array(newvalues, datatype->subtype[0], ptr, datatype->num_elements);
          for (i = 0; i < datatype->num_elements; i++) {
-            unsigned char *array_base = (unsigned char *) ptr;
-            result = copy_value(newvalues+i, datatype->subtype[type_index], array_base + bytes_read);
+            result = copy_value_to_block(newvalues+i, datatype->subtype[type_index], array_base + bytes_read,
+                                         values, strings);
             if (result == -1)
                return -1;
             bytes_read += result;
             if (datatype->dtype == adiak_tuple)
                type_index++;
          }
-         target->v_subval = newvalues;
          return bytes_read;
    }
    return -1;
 }
 
+/* Deep-copy the container value at ptr into target. The copy, including
+   nested containers and strings, is a single allocation, which
+   free_adiak_value_worker releases with a single free.
+ */
+static int copy_value(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr) {
+   size_t value_bytes = 0, string_bytes = 0;
+   unsigned char *block, *values;
+   char *strings;
+   int result;
+
+   if (datatype->is_reference || is_basetype(datatype->dtype))
+      return copy_value_to_block(target, datatype, ptr, NULL, NULL);
+
+   if (measure_value(datatype, ptr, &value_bytes, &string_bytes) == -1)
+      return -1;
+
+   block = (unsigned char *) malloc(value_bytes + string_bytes + 1);
+   if (!block)
+      return -1;
+   values = block;
+   strings = (char *) (block + value_bytes);
+
+   result = copy_value_to_block(target, datatype, ptr, &values, &strings);
+   if (result == -1 || value_block_add(block) != 0) {
+      free(block);
+      return -1;
+   }
+   return result;
+}
+
+/* Homogeneous numeric lists and sets are copied at their native element
+   width instead of as one adiak_value_t per element.
+ */
+static int is_packable(adiak_datatype_t *datatype)
+{
+   return (datatype->dtype == adiak_list || datatype->dtype == adiak_set) && datatype->num_elements > 0
+      && is_numeric_basetype(datatype->subtype[0]->dtype);
+}
+
+/* Copy the packable container at ptr into a single value block and return
+   the packed datatype for it, which replaces datatype. Falls back to
+   copy_value if the block can't be allocated. If is_owned, ptr is a
+   malloc'd buffer handed over by the caller and becomes the block. Returns
+   NULL, with datatype freed, if the value can't be copied.
+ */
+static adiak_datatype_t *pack_value(adiak_value_t *target, adiak_datatype_t *datatype, void *ptr, int is_owned)
+{
+   adiak_datatype_t proto, *packed;
+   size_t bytes = (size_t) datatype->num_elements * calc_size(datatype->subtype[0]);
+   void *block = is_owned ? ptr : malloc(bytes);
+
+   if (!block) {
+      if (copy_value(target, datatype, ptr) == -1) {
+         free_adiak_type(datatype);
+         return NULL;
+      }
+      return datatype;
+   }
+
+   if (value_block_add(block) != 0)
+      goto error;
+
+   proto = *datatype;
+   proto.is_reference = PACKED_REFERENCE;
+   proto.num_ref_elements = datatype->num_elements;
+   proto.num_elements = 0;
+   packed = intern_type_node(&proto, 0);
+   if (!packed) {
+      value_block_remove(block);
+      goto error;
+   }
+
+   if (!is_owned)
+      memcpy(block, ptr, bytes);
+   target->v_ptr = block;
+
+   free_adiak_type(datatype);
+   return packed;
+
+error:
+   if (!is_owned)
+      free(block);
+   free_adiak_type(datatype);
+   return NULL;
+}
+
+/* Copy the packed value at value into out, with one adiak_value_t per
+   element, as older tools expect. Returns -1 if it can't be copied.
+ */
+static int unpack_value(adiak_datatype_t *type, adiak_value_t *value, unpacked_value_t *out)
+{
+   adiak_datatype_t proto, *unpacked;
+
+   proto = *type;
+   proto.is_reference = 0;
+   proto.num_elements = type->num_ref_elements;
+   proto.num_ref_elements = 0;
+   unpacked = intern_type_node(&proto, 0);
+   if (!unpacked)
+      return -1;
+   if (copy_value(&out->value, unpacked, value->v_ptr) == -1) {
+      free_adiak_type(unpacked);
+      return -1;
+   }
+   out->type = unpacked;
+   return 0;
+}
+
+static void free_unpacked_value(unpacked_value_t *unpacked)
+{
+   if (!unpacked->type)
+      return;
+   free_adiak_value_worker(unpacked->type, &unpacked->value);
+   free_adiak_type(unpacked->type);
+   unpacked->type = NULL;
+}
+
 static int parse_scalar_len_spec(const char* typestr, int *pos)
 {
    if (typestr[(*pos)+1] == '8') {
@@ -855,279 +3311,1606 @@ static int parse_scalar_len_spec(const char* typestr, int *pos)
    return 0;
 }
 
-static adiak_datatype_t *parse_typestr_helper(const char *typestr, int typestr_start, int typestr_end, int is_reference,
-                                       va_list *ap, int *new_typestr_start)
-
+static int parse_error(typestr_parser_t *p, const char *reason)
 {
-   adiak_datatype_t *t = NULL;
-   int cur = typestr_start;
-   int end_brace, i;
-   int is_long = 0, is_longlong = 0;
+   if (!p->error) {
+      p->error = reason;
+      p->error_pos = p->pos;
+   }
+   return -1;
+}
 
-   if (!typestr)
-      goto error;
-   if (typestr_start == typestr_end)
-      goto error;
+static void parse_skip_separators(typestr_parser_t *p)
+{
+   while (isspace(p->str[p->pos]) || p->str[p->pos] == ',')
+      p->pos++;
+}
 
-   while (isspace(typestr[cur]) || typestr[cur] == ',')
-      cur++;
-   if (typestr[cur] == '&') {
-      is_reference = 1;
-      cur++;
+static int parse_count(typestr_parser_t *p, int *count)
+{
+   *count = va_arg(*p->ap, int);
+   if (*count < 0)
+      return parse_error(p, "negative element count");
+   if (p->counts) {
+      if (p->num_counts == p->max_counts) {
+         /* too many counts to record */
+         p->counts = NULL;
+         p->num_counts = -1;
+      } else {
+         p->counts[p->num_counts++] = *count;
+      }
    }
+   return 0;
+}
 
-   if (strchr("[{<(", typestr[cur])) {
-      t = (adiak_datatype_t *) malloc(sizeof(adiak_datatype_t));
-      memset(t, 0, sizeof(*t));
-   }
-   if (typestr[cur] == '{' || typestr[cur] == '[') {
-      end_brace = find_end_brace(typestr, typestr[cur] == '{' ? '}' : ']',
-                                 cur, typestr_end);
-      if (end_brace == -1)
-         goto error;
-      int num_elements = va_arg(*ap, int);
-      t->num_elements = (is_reference ? 0 : num_elements);
-      t->num_ref_elements = (is_reference ? num_elements : 0);
-      t->dtype = typestr[cur] == '{' ? adiak_list : adiak_set;
-      t->numerical = adiak_categorical;
-      t->is_reference = is_reference;
-      t->num_subtypes = 1;
-      t->subtype = (adiak_datatype_t **) malloc(sizeof(adiak_datatype_t *));
-      t->subtype[0] = parse_typestr_helper(typestr, cur+1, end_brace, is_reference, ap, &cur);
-      if (t->subtype[0] == NULL)
-         goto error;
-      *new_typestr_start = end_brace+1;
-      goto done;
-   }
-   else if (typestr[cur] == '<') {
-      end_brace = find_end_brace(typestr, '>', cur, typestr_end);
-      if (end_brace == -1)
-         goto error;
-      t->dtype = adiak_range;
-      t->numerical = adiak_categorical;
-      t->is_reference = is_reference;
-      t->num_elements = (is_reference ? 0 : 2);
-      t->num_ref_elements = (is_reference ? 2 : 0);
-      t->num_subtypes = 1;
-      t->subtype = (adiak_datatype_t **) malloc(sizeof(adiak_datatype_t *));
-      t->subtype[0] = parse_typestr_helper(typestr, cur+1, end_brace, is_reference, ap, &cur);
-      if (t->subtype[0] == NULL)
-         goto error;
-      *new_typestr_start = end_brace+1;
-      goto done;
-   }
-   else if (typestr[cur] == '(') {
-      end_brace = find_end_brace(typestr, ')', cur, typestr_end);
-      if (end_brace == -1)
-         goto error;
-      t->dtype = adiak_tuple;
-      t->numerical = adiak_categorical;
-      t->is_reference = is_reference;
-      int num_elements = va_arg(*ap, int);
-      t->num_elements = (is_reference ? 0 : num_elements);
-      t->num_ref_elements = (is_reference ? num_elements : 0);
-      t->num_subtypes = num_elements;
-      t->subtype = (adiak_datatype_t **) malloc(sizeof(adiak_datatype_t *) * t->num_subtypes);
-      memset(t->subtype, 0, sizeof(adiak_datatype_t *) * t->num_subtypes);
-      cur++;
-      for (i = 0; i < t->num_subtypes; i++) {
-         t->subtype[i] = parse_typestr_helper(typestr, cur, end_brace, is_reference, ap, &cur);
-         if (!t->subtype[i])
-            goto error;
+static int parse_close(typestr_parser_t *p, char endchar)
+{
+   parse_skip_separators(p);
+   if (p->str[p->pos] != endchar) {
+      switch (endchar) {
+         case '}': return parse_error(p, "expected '}'");
+         case ']': return parse_error(p, "expected ']'");
+         case '>': return parse_error(p, "expected '>'");
+         default:  return parse_error(p, "expected ')'");
       }
    }
-   else if (typestr[cur] == '%') {
+   p->pos++;
+   return 0;
+}
+
+static int parse_scalar(typestr_parser_t *p, int is_reference, adiak_datatype_t **out)
+{
+   const char *typestr = p->str;
+   int is_long = 0, is_longlong = 0;
+   int cur = p->pos + 1;
+   adiak_datatype_t *t = NULL;
+
+   if (typestr[cur] == 'l') {
+      is_long = 1;
       cur++;
       if (typestr[cur] == 'l') {
-         is_long = 1;
+         is_longlong = 1;
          cur++;
-         if (typestr[cur] == 'l') {
-            is_longlong = 1;
-            cur++;
-         }
       }
-      switch (typestr[cur]) {
-         case 'd':
-            t = is_long ? (is_longlong ? &base_longlong  : &base_long)  : &base_int;
+   }
+   p->pos = cur;
+   switch (typestr[cur]) {
+      case 'd':
+         t = is_long ? (is_longlong ? &base_longlong  : &base_long)  : &base_int;
+         break;
+      case 'u':
+         switch (parse_scalar_len_spec(typestr, &cur)) {
+         case 0:
+            t = is_long ? (is_longlong ? &base_ulonglong : &base_ulong) : &base_uint;
             break;
-         case 'u':
-            switch (parse_scalar_len_spec(typestr, &cur)) {
-            case 0:
-               t = is_long ? (is_longlong ? &base_ulonglong : &base_ulong) : &base_uint;
-               break;
-            case 1:
-               t = &base_u8;
-               break;
-            case 2:
-               t = &base_u16;
-               break;
-            case 4:
-               t = &base_uint;
-               break;
-            case 8:
-               t = &base_ulonglong;
-               break;
-            default:
-               goto error;
-            }
+         case 1:
+            t = &base_u8;
             break;
-         case 'i':
-            switch (parse_scalar_len_spec(typestr, &cur)) {
-            case 0:
-            case 4:
-               t = &base_int;
-               break;
-            case 1:
-               t = &base_i8;
-               break;
-            case 2:
-               t = &base_i16;
-               break;
-            case 8:
-               t = &base_longlong;
-               break;
-            default:
-               goto error;
-            }
+         case 2:
+            t = &base_u16;
             break;
-         case 'f':
-            switch (parse_scalar_len_spec(typestr, &cur)) {
-            case 0:
-            case 8:
-               t = &base_double;
-               break;
-            case 4:
-               t = &base_float;
-               break;
-            default:
-               goto error;
-            }
+         case 4:
+            t = &base_uint;
             break;
-         case 'D':
-            t = &base_date;
+         case 8:
+            t = &base_ulonglong;
             break;
-         case 't':
-            t = &base_timeval;
+         }
+         break;
+      case 'i':
+         switch (parse_scalar_len_spec(typestr, &cur)) {
+         case 0:
+         case 4:
+            t = &base_int;
             break;
-         case 'v':
-            t = (is_reference ? &base_version_ref : &base_version);
+         case 1:
+            t = &base_i8;
             break;
-         case 's':
-            t = (is_reference ? &base_string_ref : &base_string);
+         case 2:
+            t = &base_i16;
             break;
-         case 'r':
-            t = (is_reference ? &base_catstring_ref : &base_catstring);
+         case 8:
+            t = &base_longlong;
             break;
-         case 'j':
-            t = (is_reference ? &base_jsonstring_ref : &base_jsonstring);
+         }
+         break;
+      case 'f':
+         switch (parse_scalar_len_spec(typestr, &cur)) {
+         case 0:
+         case 8:
+            t = &base_double;
             break;
-         case 'p':
-            t = (is_reference ? &base_path_ref : &base_path);
+         case 4:
+            t = &base_float;
             break;
-         default:
-            goto error;
-      }
-      cur++;
-      *new_typestr_start = cur;
-      goto done;
-   }
-
-  done:
-   return t;
-  error:
-   if (t)
-      free_adiak_type(t);
-   return NULL;
+         }
+         break;
+      case 'D':
+         t = &base_date;
+         break;
+      case 't':
+         t = &base_timeval;
+         break;
+      case 'v':
+         t = (is_reference ? &base_version_ref : &base_version);
+         break;
+      case 's':
+         t = (is_reference ? &base_string_ref : &base_string);
+         break;
+      case 'r':
+         t = (is_reference ? &base_catstring_ref : &base_catstring);
+         break;
+      case 'j':
+         t = (is_reference ? &base_jsonstring_ref : &base_jsonstring);
+         break;
+      case 'p':
+         t = (is_reference ? &base_path_ref : &base_path);
+         break;
+      case '\0':
+         return parse_error(p, "incomplete type specifier");
+      default:
+         return parse_error(p, "unknown type specifier");
+   }
+   if (!t) {
+      p->pos++;
+      return parse_error(p, "invalid size for type specifier");
+   }
+   p->pos = cur + 1;
+   *out = t;
+   return 0;
 }
 
-static size_t strhash_djb2(const char *str) {
-    size_t hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+static adiak_datatype_t *new_container_type(adiak_type_t dtype, int num_elements, int num_subtypes,
+                                            int is_reference)
+{
+   adiak_datatype_t *t = (adiak_datatype_t *) malloc(sizeof(adiak_datatype_t));
+   memset(t, 0, sizeof(*t));
+   t->dtype = dtype;
+   t->numerical = adiak_categorical;
+   t->is_reference = is_reference;
+   t->num_elements = (is_reference ? 0 : num_elements);
+   t->num_ref_elements = (is_reference ? num_elements : 0);
+   t->num_subtypes = num_subtypes;
+   if (num_subtypes) {
+      t->subtype = (adiak_datatype_t **) malloc(sizeof(adiak_datatype_t *) * num_subtypes);
+      memset(t->subtype, 0, sizeof(adiak_datatype_t *) * num_subtypes);
+   }
+   return t;
 }
 
-static record_list_t** get_record_hash_list(adiak_t* adiak_config)
+/* Parse one type at p->pos. With p->build, *out is the new datatype;
+   otherwise *out is left unchanged. Returns -1 and sets p->error on
+   malformed input.
+ */
+static int parse_type(typestr_parser_t *p, int is_reference, adiak_datatype_t **out)
 {
-   return adiak_config->minimum_version >= 1 ? adiak_config->record_hash : local_record_hash;
+   adiak_datatype_t *t = NULL, *sub = NULL;
+   int num_elements = 0, i;
+   char c, endchar;
+
+   parse_skip_separators(p);
+   if (p->str[p->pos] == '&') {
+      is_reference = 1;
+      p->pos++;
+   }
+
+   c = p->str[p->pos];
+   switch (c) {
+      case '%':
+         return parse_scalar(p, is_reference, out);
+      case '{':
+      case '[':
+      case '<':
+         endchar = (c == '{' ? '}' : (c == '[' ? ']' : '>'));
+         if (c == '<')
+            num_elements = 2;
+         else if (parse_count(p, &num_elements) != 0)
+            return -1;
+         p->pos++;
+         if (parse_type(p, is_reference, &sub) != 0 || parse_close(p, endchar) != 0)
+            goto error;
+         if (p->build) {
+            t = new_container_type(c == '{' ? adiak_list : (c == '[' ? adiak_set : adiak_range),
+                                   num_elements, 1, is_reference);
+            t->subtype[0] = sub;
+            *out = t;
+         }
+         return 0;
+      case '(':
+         if (parse_count(p, &num_elements) != 0)
+            return -1;
+         p->pos++;
+         if (p->build)
+            t = new_container_type(adiak_tuple, num_elements, num_elements, is_reference);
+         for (i = 0; i < num_elements; i++) {
+            parse_skip_separators(p);
+            if (p->str[p->pos] == ')') {
+               parse_error(p, "tuple has fewer elements than its count");
+               goto error;
+            }
+            if (parse_type(p, is_reference, t ? t->subtype + i : &sub) != 0)
+               goto error;
+         }
+         parse_skip_separators(p);
+         if (p->str[p->pos] != ')' && p->str[p->pos] != '\0') {
+            parse_error(p, "tuple has more elements than its count");
+            goto error;
+         }
+         if (parse_close(p, ')') != 0)
+            goto error;
+         if (t)
+            *out = t;
+         return 0;
+      case '\0':
+         return parse_error(p, "expected a type");
+      default:
+         return parse_error(p, "unexpected character");
+   }
+
+  error:
+   if (t)
+      free_adiak_type_tree(t);
+   else if (p->build && sub)
+      free_adiak_type_tree(sub);
+   return -1;
 }
 
-static record_list_t* find_record_by_name(const char* name)
+/* Parse a complete type string. Trailing whitespace is allowed. */
+static int parse_typestr_full(typestr_parser_t *p, adiak_datatype_t **out)
 {
-   record_list_t* rec = NULL;
-   adiak_t* adiak_config = adiak_get_config();
-   record_list_t** record_hash = get_record_hash_list(adiak_config);
+   adiak_datatype_t *t = NULL;
 
-   size_t hashval = strhash_djb2(name) % RECORD_HASH_SIZE;
-   for (rec = record_hash[hashval]; rec != NULL; rec = rec->hash_next) {
-      if (strcmp(rec->name, name) == 0)
-         break;
+   if (parse_type(p, 0, &t) != 0)
+      return -1;
+   while (isspace(p->str[p->pos]))
+      p->pos++;
+   if (p->str[p->pos] != '\0') {
+      parse_error(p, "unexpected characters after type");
+      if (t)
+         free_adiak_type_tree(t);
+      return -1;
    }
+   *out = t;
+   return 0;
+}
 
-   return rec;
+static uint64_t strhash_mix(uint64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 33;
+   return h;
 }
 
-static record_list_t* record_nameval(const char *name, int category, const char *subcategory,
-                                     adiak_value_t *value, adiak_datatype_t *dtype)
+/* Word-at-a-time multiply/rotate string hash with a murmur3 finalizer. */
+static uint64_t strhash(const char *str)
 {
-   record_list_t *addrecord = NULL, *i;
-   int newrecord = 0;
-   size_t hashval = 0;
+   size_t len = strlen(str);
+   uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (len * 0xc2b2ae3d27d4eb4fULL);
+   uint64_t word;
+
+   for ( ; len >= 8; len -= 8, str += 8) {
+      memcpy(&word, str, 8);
+      word *= 0x87c37b91114253d5ULL;
+      word = (word << 31) | (word >> 33);
+      hash ^= word * 0x4cf5ad432745937fULL;
+      hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52dce729;
+   }
+   word = 0;
+   memcpy(&word, str, len);
+   hash ^= word * 0x87c37b91114253d5ULL;
 
-   adiak_t* adiak_config = adiak_get_config();
-   record_list_t** record_hash = get_record_hash_list(adiak_config);
+   return strhash_mix(hash);
+}
+
+static record_store_t* get_record_store(adiak_t* adiak_config)
+{
+   record_store_t *store;
+
+   if (adiak_config->minimum_version < 3)
+      return &local_record_store;
+   store = __atomic_load_n(&adiak_config->record_store, __ATOMIC_ACQUIRE);
+   if (!store && __atomic_compare_exchange_n(&adiak_config->record_store, &store, &local_record_store, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return &local_record_store;
+   if (store->version != RECORD_STORE_VERSION || store->size != sizeof(record_store_t))
+      return &local_record_store;
+   return store;
+}
+
+static record_shard_t* get_record_shard(uint64_t hash)
+{
+   return &get_record_store(adiak_get_config())->records[SHARD_OF(hash, RECORD_SHARDS)];
+}
+
+static string_shard_t* get_string_shard(uint64_t hash)
+{
+   return &get_record_store(adiak_get_config())->strings[SHARD_OF(hash, STRING_SHARDS)];
+}
+
+static __thread char lock_owner_tag;
+
+static int lock_held(adiak_lock_t* lock)
+{
+   return __atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == &lock_owner_tag;
+}
+
+static void lock_acquire(adiak_lock_t* lock)
+{
+   void* self = &lock_owner_tag;
+   void* expected;
+   int spins = 0;
 
-   hashval = strhash_djb2(name) % RECORD_HASH_SIZE;
-   for (i = record_hash[hashval]; i != NULL; i = i->hash_next) {
-      if (strcmp(i->name, name) == 0) {
-         addrecord = i;
+   /* only this thread can have stored its own tag */
+   if (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == self) {
+      lock->count++;
+      return;
+   }
+
+   for (;;) {
+      expected = NULL;
+      if (__atomic_compare_exchange_n(&lock->owner, &expected, self, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
          break;
+      while (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) != NULL) {
+         if (++spins == LOCK_SPINS_BEFORE_YIELD) {
+            adksys_yield();
+            spins = 0;
+         }
+      }
+   }
+   lock->count = 1;
+}
+
+static void lock_release(adiak_lock_t* lock)
+{
+   if (--lock->count == 0)
+      __atomic_store_n(&lock->owner, NULL, __ATOMIC_RELEASE);
+}
+
+static record_list_t* record_list_head(adiak_t* adiak_config)
+{
+   return __atomic_load_n(&adiak_config->shared_record_list, __ATOMIC_ACQUIRE);
+}
+
+static void* arena_alloc(adiak_arena_t* arena, size_t bytes)
+{
+   arena_chunk_t* chunk = arena->head;
+   size_t header = ARENA_ROUND_UP(sizeof(arena_chunk_t));
+   void* ptr;
+
+   bytes = ARENA_ROUND_UP(bytes);
+
+   if (!chunk || chunk->used + bytes > chunk->size) {
+      size_t size = arena->next_chunk_size ? arena->next_chunk_size : ARENA_MIN_CHUNK_SIZE;
+      if (size < ARENA_MAX_CHUNK_SIZE)
+         arena->next_chunk_size = size * 2;
+      if (size < header + bytes)
+         size = header + bytes;
+
+      chunk = (arena_chunk_t *) malloc(size);
+      if (!chunk)
+         return NULL;
+      chunk->size = size;
+      chunk->used = header;
+      chunk->next = arena->head;
+      arena->head = chunk;
+   }
+
+   ptr = ((unsigned char *) chunk) + chunk->used;
+   chunk->used += bytes;
+   return ptr;
+}
+
+static char* arena_strdup(adiak_arena_t* arena, const char* str)
+{
+   size_t len = strlen(str) + 1;
+   char* copy = (char *) arena_alloc(arena, len);
+   if (copy)
+      memcpy(copy, str, len);
+   return copy;
+}
+
+static void arena_free_all(adiak_arena_t* arena)
+{
+   arena_chunk_t *chunk, *next;
+   for (chunk = arena->head; chunk != NULL; chunk = next) {
+      next = chunk->next;
+      free(chunk);
+   }
+   arena->head = NULL;
+   arena->next_chunk_size = 0;
+}
+
+static const char* string_pool_find(string_pool_t* pool, const char* str, uint64_t hash)
+{
+   size_t mask, pos;
+
+   if (pool->capacity == 0)
+      return NULL;
+
+   mask = pool->capacity - 1;
+   for (pos = hash & mask; pool->entries[pos].str != NULL; pos = (pos + 1) & mask) {
+      if (pool->entries[pos].hash == hash && strcmp(pool->entries[pos].str, str) == 0)
+         return pool->entries[pos].str;
+   }
+   return NULL;
+}
+
+static void string_pool_place(string_pool_entry_t* entries, size_t capacity, uint64_t hash, const char* str)
+{
+   size_t mask = capacity - 1;
+   size_t pos = hash & mask;
+
+   while (entries[pos].str != NULL)
+      pos = (pos + 1) & mask;
+
+   entries[pos].hash = hash;
+   entries[pos].str = str;
+}
+
+static int string_pool_grow(string_pool_t* pool)
+{
+   size_t newcap = pool->capacity ? pool->capacity * 2 : RECORD_INDEX_MIN_CAPACITY;
+   string_pool_entry_t* newentries;
+   size_t i;
+
+   newentries = (string_pool_entry_t *) calloc(newcap, sizeof(string_pool_entry_t));
+   if (!newentries)
+      return -1;
+
+   for (i = 0; i < pool->capacity; ++i)
+      if (pool->entries[i].str)
+         string_pool_place(newentries, newcap, pool->entries[i].hash, pool->entries[i].str);
+
+   free(pool->entries);
+   pool->entries = newentries;
+   pool->capacity = newcap;
+   return 0;
+}
+
+static const char* string_pool_intern(string_pool_t* pool, const char* str, uint64_t hash)
+{
+   const char* result = string_pool_find(pool, str, hash);
+   size_t len = strlen(str) + 1;
+
+   if (result) {
+      pool->bytes_saved += len;
+      return result;
+   }
+
+   if ((pool->count + 1) * 100 > pool->capacity * RECORD_INDEX_MAX_LOAD)
+      if (string_pool_grow(pool) != 0)
+         return NULL;
+
+   result = arena_strdup(&pool->arena, str);
+   if (!result)
+      return NULL;
+
+   string_pool_place(pool->entries, pool->capacity, hash, result);
+   pool->count++;
+   pool->bytes_used += len;
+   return result;
+}
+
+static void string_pool_clear(string_pool_t* pool)
+{
+   free(pool->entries);
+   arena_free_all(&pool->arena);
+   memset(pool, 0, sizeof(string_pool_t));
+}
+
+static const char* intern_string(const char* str)
+{
+   return intern_string_hashed(str, strhash(str));
+}
+
+static const char* intern_string_hashed(const char* str, uint64_t hash)
+{
+   string_shard_t* shard = get_string_shard(hash);
+   const char* result;
+
+   lock_acquire(&shard->lock);
+   result = string_pool_intern(&shard->pool, str, hash);
+   lock_release(&shard->lock);
+   return result;
+}
+
+static int is_interned_string(const char* str)
+{
+   uint64_t hash = strhash(str);
+   string_shard_t* shard = get_string_shard(hash);
+   const char* found;
+
+   lock_acquire(&shard->lock);
+   found = string_pool_find(&shard->pool, str, hash);
+   lock_release(&shard->lock);
+   return found == str;
+}
+
+/* Categorical strings come from a small vocabulary and are interned.
+   Other string values are copied. */
+static char* copy_string_value(adiak_datatype_t* t, const char* str)
+{
+   if (t->dtype == adiak_catstring || t->dtype == adiak_path)
+      return (char *) intern_string(str);
+   return strdup(str);
+}
+
+static char value_block_tombstone;
+
+static value_block_shard_t* get_value_block_shard(void *block)
+{
+   uint64_t hash = strhash_mix((uint64_t) (uintptr_t) block);
+   return &get_record_store(adiak_get_config())->value_blocks[SHARD_OF(hash, VALUE_BLOCK_SHARDS)];
+}
+
+static size_t value_block_slot(void *block, size_t capacity)
+{
+   return (size_t) strhash_mix((uint64_t) (uintptr_t) block) & (capacity - 1);
+}
+
+static int value_block_set_rehash(value_block_set_t *set, size_t capacity)
+{
+   void **slots = (void **) calloc(capacity, sizeof(void *));
+   size_t i, pos;
+
+   if (!slots)
+      return -1;
+   for (i = 0; i < set->capacity; ++i) {
+      if (set->slots[i] == NULL || set->slots[i] == &value_block_tombstone)
+         continue;
+      for (pos = value_block_slot(set->slots[i], capacity); slots[pos] != NULL; pos = (pos + 1) & (capacity - 1))
+         ;
+      slots[pos] = set->slots[i];
+   }
+   free(set->slots);
+   set->slots = slots;
+   set->capacity = capacity;
+   set->used = set->count;
+   return 0;
+}
+
+/* Register block as a value block. Returns -1 if the set can't grow. */
+static int value_block_add(void *block)
+{
+   value_block_shard_t *shard = get_value_block_shard(block);
+   value_block_set_t *set = &shard->set;
+   size_t pos, capacity;
+
+   lock_acquire(&shard->lock);
+   if ((set->used + 1) * 100 > set->capacity * RECORD_INDEX_MAX_LOAD) {
+      capacity = set->capacity ? set->capacity : VALUE_BLOCK_MIN_CAPACITY;
+      /* grow unless mostly tombstones */
+      if ((set->count + 1) * 100 > capacity * RECORD_INDEX_MAX_LOAD / 2)
+         capacity *= 2;
+      if (value_block_set_rehash(set, capacity) != 0) {
+         lock_release(&shard->lock);
+         return -1;
+      }
+   }
+   for (pos = value_block_slot(block, set->capacity);
+        set->slots[pos] != NULL && set->slots[pos] != &value_block_tombstone;
+        pos = (pos + 1) & (set->capacity - 1))
+      ;
+   if (set->slots[pos] == NULL)
+      set->used++;
+   set->slots[pos] = block;
+   set->count++;
+   lock_release(&shard->lock);
+   return 0;
+}
+
+/* Remove block from the set. Returns 1 if it was a value block. */
+static int value_block_remove(void *block)
+{
+   value_block_shard_t *shard;
+   value_block_set_t *set;
+   size_t pos;
+   int found = 0;
+
+   if (!block)
+      return 0;
+
+   shard = get_value_block_shard(block);
+   set = &shard->set;
+
+   lock_acquire(&shard->lock);
+   if (set->capacity > 0) {
+      for (pos = value_block_slot(block, set->capacity); set->slots[pos] != NULL;
+           pos = (pos + 1) & (set->capacity - 1))
+         if (set->slots[pos] == block) {
+            set->slots[pos] = &value_block_tombstone;
+            set->count--;
+            found = 1;
+            break;
+         }
+   }
+   lock_release(&shard->lock);
+   return found;
+}
+
+static void value_block_set_clear(value_block_set_t *set)
+{
+   free(set->slots);
+   memset(set, 0, sizeof(*set));
+}
+
+static record_list_t* record_index_find(record_index_t* index, const char* name, uint64_t hash)
+{
+   size_t mask, pos;
+
+   if (index->capacity == 0)
+      return NULL;
+
+   mask = index->capacity - 1;
+   for (pos = hash & mask; index->entries[pos].record != NULL; pos = (pos + 1) & mask) {
+      if (index->entries[pos].hash == hash && strcmp(index->entries[pos].record->name, name) == 0)
+         return index->entries[pos].record;
+   }
+   return NULL;
+}
+
+static void record_index_place(record_index_entry_t* entries, size_t capacity, uint64_t hash, record_list_t* rec)
+{
+   size_t mask = capacity - 1;
+   size_t pos = hash & mask;
+
+   while (entries[pos].record != NULL)
+      pos = (pos + 1) & mask;
+
+   entries[pos].hash = hash;
+   entries[pos].record = rec;
+}
+
+static int record_index_grow(record_index_t* index)
+{
+   size_t newcap = index->capacity ? index->capacity * 2 : RECORD_INDEX_MIN_CAPACITY;
+   record_index_entry_t* newentries;
+   size_t i;
+
+   newentries = (record_index_entry_t *) calloc(newcap, sizeof(record_index_entry_t));
+   if (!newentries)
+      return -1;
+
+   for (i = 0; i < index->capacity; ++i)
+      if (index->entries[i].record)
+         record_index_place(newentries, newcap, index->entries[i].hash, index->entries[i].record);
+
+   free(index->entries);
+   index->entries = newentries;
+   index->capacity = newcap;
+   return 0;
+}
+
+/* Make room for one more record in index. Returns -1 if it can't grow. */
+static int record_index_reserve(record_index_t* index)
+{
+   if ((index->count + 1) * 100 > index->capacity * RECORD_INDEX_MAX_LOAD)
+      return record_index_grow(index);
+   return 0;
+}
+
+static int record_index_insert(record_index_t* index, record_list_t* rec, uint64_t hash)
+{
+   if (record_index_reserve(index) != 0)
+      return -1;
+
+   record_index_place(index->entries, index->capacity, hash, rec);
+   index->count++;
+   return 0;
+}
+
+static void record_index_clear(record_index_t* index)
+{
+   free(index->entries);
+   index->entries = NULL;
+   index->capacity = 0;
+   index->count = 0;
+}
+
+static void record_table_locate(size_t i, int *segment, size_t *offset)
+{
+   size_t n = i / RECORD_TABLE_FIRST_SEGMENT + 1;
+   int k = 63 - __builtin_clzll((unsigned long long) n);
+
+   *segment = k;
+   *offset = i - RECORD_TABLE_FIRST_SEGMENT * (((size_t) 1 << k) - 1);
+}
+
+static record_slot_t* record_table_segment(record_table_t *table, int k)
+{
+   record_slot_t *segment = __atomic_load_n(&table->segments[k], __ATOMIC_ACQUIRE);
+   record_slot_t *expected = NULL;
+
+   if (segment)
+      return segment;
+
+   segment = (record_slot_t *) calloc(RECORD_TABLE_FIRST_SEGMENT << k, sizeof(record_slot_t));
+   if (!segment)
+      return NULL;
+   if (!__atomic_compare_exchange_n(&table->segments[k], &expected, segment, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(segment);
+      segment = expected;
+   }
+   return segment;
+}
+
+static record_slot_t* record_table_append(record_table_t *table, size_t *position)
+{
+   size_t i = __atomic_fetch_add(&table->count, 1, __ATOMIC_RELAXED);
+   record_slot_t *segment;
+   size_t offset;
+   int k;
+
+   record_table_locate(i, &k, &offset);
+   if (k >= RECORD_TABLE_SEGMENTS)
+      return NULL;
+   *position = i;
+   segment = record_table_segment(table, k);
+   return segment ? segment + offset : NULL;
+}
+
+/* Returns the i-th record in insertion order, or NULL if it is not yet
+   initialized. */
+static record_list_t* record_table_get(record_table_t *table, size_t i)
+{
+   record_slot_t *segment;
+   size_t offset;
+   int k;
+
+   record_table_locate(i, &k, &offset);
+   segment = __atomic_load_n(&table->segments[k], __ATOMIC_ACQUIRE);
+   if (!segment || !__atomic_load_n(&segment[offset].record.name, __ATOMIC_ACQUIRE))
+      return NULL;
+   return &segment[offset].record;
+}
+
+/* Records created by this library are always in the record table */
+static size_t record_position(record_list_t *rec)
+{
+   return ((record_slot_t *) rec)->position;
+}
+
+static size_t category_hash(int category)
+{
+   return (size_t) ((uint32_t) category * 2654435761u);
+}
+
+static int category_index_grow(category_index_t *index)
+{
+   size_t capacity = index->capacity ? index->capacity * 2 : CATEGORY_INDEX_MIN_CAPACITY;
+   category_entry_t *entries;
+   size_t i, pos;
+
+   entries = (category_entry_t *) calloc(capacity, sizeof(category_entry_t));
+   if (!entries)
+      return -1;
+   for (i = 0; i < index->capacity; ++i) {
+      if (!index->entries[i].used)
+         continue;
+      for (pos = category_hash(index->entries[i].category) & (capacity - 1); entries[pos].used;
+           pos = (pos + 1) & (capacity - 1))
+         ;
+      entries[pos] = index->entries[i];
+   }
+
+   free(index->entries);
+   index->entries = entries;
+   index->capacity = capacity;
+   return 0;
+}
+
+/* Find the entry for category. If create is set, a missing entry is added. */
+static category_entry_t* category_index_find(category_index_t *index, int category, int create)
+{
+   size_t mask, pos;
+
+   if (create && (index->count + 1) * 100 > index->capacity * RECORD_INDEX_MAX_LOAD)
+      if (category_index_grow(index) != 0)
+         return NULL;
+   if (index->capacity == 0)
+      return NULL;
+
+   mask = index->capacity - 1;
+   for (pos = category_hash(category) & mask; index->entries[pos].used; pos = (pos + 1) & mask)
+      if (index->entries[pos].category == category)
+         return &index->entries[pos];
+   if (!create)
+      return NULL;
+
+   index->entries[pos].used = 1;
+   index->entries[pos].category = category;
+   index->count++;
+   return &index->entries[pos];
+}
+
+/* Binary search for the first position >= p */
+static size_t category_entry_lower_bound(category_entry_t *entry, size_t p)
+{
+   size_t lo = 0, hi = entry->count;
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (entry->positions[mid] < p)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+/* Move rec from category from to category to. If is_new is set, rec is
+   not in any category yet. */
+static void category_index_move(record_list_t *rec, int is_new, int from, int to)
+{
+   category_index_t *index = &get_record_store(adiak_get_config())->categories;
+   category_entry_t *entry;
+   size_t p = record_position(rec), i;
+
+   lock_acquire(&index->lock);
+
+   if (!is_new) {
+      entry = category_index_find(index, from, 0);
+      if (entry) {
+         i = category_entry_lower_bound(entry, p);
+         if (i < entry->count && entry->positions[i] == p) {
+            memmove(entry->positions + i, entry->positions + i + 1, (entry->count - i - 1) * sizeof(size_t));
+            entry->count--;
+         }
+      }
+   }
+
+   entry = category_index_find(index, to, 1);
+   if (entry && entry->count == entry->capacity) {
+      size_t capacity = entry->capacity ? entry->capacity * 2 : 16;
+      size_t *positions = (size_t *) realloc(entry->positions, capacity * sizeof(size_t));
+      if (positions) {
+         entry->positions = positions;
+         entry->capacity = capacity;
+      }
+   }
+   if (entry && entry->count < entry->capacity) {
+      /* new records usually go to the end */
+      i = (entry->count == 0 || entry->positions[entry->count - 1] < p) ? entry->count
+                                                                        : category_entry_lower_bound(entry, p);
+      memmove(entry->positions + i + 1, entry->positions + i, (entry->count - i) * sizeof(size_t));
+      entry->positions[i] = p;
+      entry->count++;
+   }
+
+   lock_release(&index->lock);
+}
+
+/* Copy the table positions of category's records into a new array */
+static size_t* category_index_snapshot(int category, size_t *count)
+{
+   category_index_t *index = &get_record_store(adiak_get_config())->categories;
+   category_entry_t *entry;
+   size_t *positions = NULL;
+
+   *count = 0;
+   lock_acquire(&index->lock);
+   entry = category_index_find(index, category, 0);
+   if (entry && entry->count > 0) {
+      positions = (size_t *) malloc(entry->count * sizeof(size_t));
+      if (positions) {
+         memcpy(positions, entry->positions, entry->count * sizeof(size_t));
+         *count = entry->count;
       }
    }
+   lock_release(&index->lock);
+   return positions;
+}
+
+static void category_index_clear(category_index_t *index)
+{
+   size_t i;
+   for (i = 0; i < index->capacity; ++i)
+      free(index->entries[i].positions);
+   free(index->entries);
+   index->entries = NULL;
+   index->capacity = 0;
+   index->count = 0;
+}
+
+static void record_table_clear(record_table_t *table)
+{
+   int k;
+   for (k = 0; k < RECORD_TABLE_SEGMENTS; ++k) {
+      free(table->segments[k]);
+      table->segments[k] = NULL;
+   }
+   table->count = 0;
+}
+
+static uint64_t record_generation(record_list_t *rec)
+{
+   return __atomic_load_n(&((record_slot_t *) rec)->generation, __ATOMIC_ACQUIRE);
+}
+
+/* Make room in a full change log: drop stale entries, and grow the log
+   unless that freed at least half of it. Callers hold the shard lock.
+ */
+static int change_log_make_room(change_log_t *log, record_table_t *table)
+{
+   change_entry_t *entries;
+   size_t capacity, i, n = 0;
+
+   for (i = 0; i < log->count; ++i) {
+      record_list_t *rec = record_table_get(table, log->entries[i].position);
+      if (rec && record_generation(rec) == log->entries[i].generation)
+         log->entries[n++] = log->entries[i];
+   }
+   log->count = n;
+   if (log->capacity > 0 && n <= log->capacity / 2)
+      return 0;
+
+   capacity = log->capacity ? 2 * log->capacity : CHANGE_LOG_MIN_CAPACITY;
+   entries = (change_entry_t *) realloc(log->entries, capacity * sizeof(change_entry_t));
+   if (!entries)
+      return log->count < log->capacity ? 0 : -1;
+   log->entries = entries;
+   log->capacity = capacity;
+   return 0;
+}
+
+/* Give rec the next generation and log it. Callers hold the shard lock. */
+static void change_log_append(record_shard_t *shard, record_list_t *rec)
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   change_log_t *log = &shard->changes;
+   uint64_t generation = __atomic_add_fetch(&store->generation, 1, __ATOMIC_ACQ_REL);
+
+   __atomic_store_n(&((record_slot_t *) rec)->generation, generation, __ATOMIC_RELEASE);
+   if (log->count < log->capacity || change_log_make_room(log, &store->table) == 0) {
+      log->entries[log->count].generation = generation;
+      log->entries[log->count].position = record_position(rec);
+      ++log->count;
+   } else {
+      log->incomplete = 1;
+   }
+}
+
+static int compare_change_entries_cb(const void *a, const void *b)
+{
+   uint64_t ga = ((const change_entry_t *) a)->generation, gb = ((const change_entry_t *) b)->generation;
+   return ga < gb ? -1 : ga > gb;
+}
+
+/* Collect the log entries in (generation, current] from all shards, in
+   generation order. Generations up to current were taken before this
+   call, and each was logged under the shard lock it was taken with, so
+   none are missing. Returns the number of entries, or (size_t) -1 if a log
+   is incomplete or the entries can't be allocated.
+ */
+static size_t changes_since(uint64_t generation, uint64_t current, change_entry_t **entries)
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   size_t count = 0, capacity = 0, lo, hi, mid, n;
+   change_entry_t *list = NULL, *grown;
+   int k, failed = 0;
+
+   for (k = 0; k < RECORD_SHARDS && !failed; ++k) {
+      record_shard_t *shard = store->records + k;
+      change_log_t *log = &shard->changes;
+
+      lock_acquire(&shard->lock);
+      failed = log->incomplete;
+      /* generations increase along the log */
+      lo = 0;
+      hi = log->count;
+      while (lo < hi) {
+         mid = lo + (hi - lo) / 2;
+         if (log->entries[mid].generation <= generation)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+      for (n = lo; n < log->count && !failed && log->entries[n].generation <= current; ++n) {
+         if (count == capacity) {
+            capacity = capacity ? 2 * capacity : CHANGE_LOG_MIN_CAPACITY;
+            grown = (change_entry_t *) realloc(list, capacity * sizeof(change_entry_t));
+            if (!grown) {
+               failed = 1;
+               break;
+            }
+            list = grown;
+         }
+         list[count++] = log->entries[n];
+      }
+      lock_release(&shard->lock);
+   }
+
+   if (failed) {
+      free(list);
+      *entries = NULL;
+      return (size_t) -1;
+   }
+   if (count > 1)
+      qsort(list, count, sizeof(change_entry_t), compare_change_entries_cb);
+   *entries = list;
+   return count;
+}
+
+static void change_log_clear(change_log_t *log)
+{
+   free(log->entries);
+   memset(log, 0, sizeof(*log));
+}
+
+/* Create a record in shard, or return NULL if it can't be allocated.
+   Callers hold the shard lock.
+ */
+static record_list_t* new_record(record_shard_t* shard, const char *name, uint64_t hashval)
+{
+   adiak_t* adiak_config = adiak_get_config();
+   record_slot_t* slot;
+   record_list_t* rec;
+   const char* interned;
+   size_t position;
+
+   /* table slots can't be given back, so everything that can fail goes first */
+   interned = intern_string_hashed(name, hashval);
+   if (!interned || record_index_reserve(&shard->index) != 0)
+      return NULL;
+
+   slot = record_table_append(&get_record_store(adiak_config)->table, &position);
+   if (!slot)
+      return NULL;
+   rec = &slot->record;
+   rec->info = &slot->info;
+   slot->position = position;
+   __atomic_store_n(&rec->name, interned, __ATOMIC_RELEASE);
+
+   if (record_index_insert(&shard->index, rec, hashval) != 0)
+      return NULL;
+
+   return rec;
+}
+
+/* Free the value of rec. Records created by this library keep the top-level
+   value embedded; ones created by an older library copy own a heap value.
+ */
+static void free_record_value(record_list_t *rec)
+{
+   if (rec->value == &rec->embedded)
+      free_adiak_value_worker(rec->dtype, rec->value);
+   else
+      free_adiak_value(rec->dtype, rec->value);
+}
+
+/* Free the value of rec, and its datatype if free_type, once no queued
+   snapshot can refer to them. Callers hold the shard lock, under which any
+   snapshot of the value was queued.
+ */
+static void retire_record_value(record_list_t *rec, int free_type)
+{
+   async_dispatch_t *async = &get_record_store(adiak_get_config())->async;
+   uint64_t tag = __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE);
+   retired_value_t *retired;
+
+   if (__atomic_load_n(&async->head, __ATOMIC_ACQUIRE) >= tag) {
+      free_record_value(rec);
+      if (free_type)
+         free_adiak_type(rec->dtype);
+      return;
+   }
+
+   /* leak the value rather than free it under the dispatcher */
+   retired = (retired_value_t *) malloc(sizeof(retired_value_t));
+   if (!retired)
+      return;
+   retired->next = NULL;
+   retired->tag = tag;
+   retired->value = *rec->value;
+   retired->dtype = rec->dtype;
+   retired->free_type = free_type;
+   if (rec->value != &rec->embedded)
+      free(rec->value);
+
+   lock_acquire(&async->retired_lock);
+   if (async->retired_last)
+      async->retired_last->next = retired;
+   else
+      async->retired = retired;
+   async->retired_last = retired;
+   lock_release(&async->retired_lock);
+}
 
-   if (!addrecord) {
-      addrecord = (record_list_t *) malloc(sizeof(record_list_t));
-      memset(addrecord, 0, sizeof(*addrecord));
-      newrecord = 1;
+/* Set the value of rec. The top-level value is copied into the record, and
+   the existing info block (and datatype, if unchanged) is reused. The
+   timestamp is ts, or the current time if ts is NULL.
+ */
+static void update_record(record_shard_t *shard, record_list_t *rec, int category, const char *subcategory,
+                          adiak_value_t *value, adiak_datatype_t *dtype, const struct timespec *ts)
+{
+   adiak_record_info_t *info;
+
+   if (rec->value) {
+      retire_record_value(rec, rec->dtype != dtype);
+      if (rec->category != category)
+         category_index_move(rec, 0, rec->category, category);
    } else {
-      free_adiak_value(addrecord->dtype, addrecord->value);
-      free_adiak_type(addrecord->dtype);
-      free((void*) addrecord->subcategory);
-      free((void*) addrecord->info);
-      addrecord->subcategory = NULL;
+      category_index_move(rec, 1, 0, category);
    }
 
-   addrecord->category = category;
-   addrecord->subcategory = subcategory ? strdup(subcategory) : NULL;
-   addrecord->value = value;
-   addrecord->dtype = dtype;
+   if (!subcategory)
+      rec->subcategory = NULL;
+   else if (!rec->subcategory || (rec->subcategory != subcategory && strcmp(rec->subcategory, subcategory) != 0))
+      rec->subcategory = intern_string(subcategory);
 
-   adiak_record_info_t* info = malloc(sizeof(adiak_record_info_t));
-   memset(info, 0, sizeof(adiak_record_info_t));
+   rec->category = category;
+   rec->embedded = *value;
+   rec->value = &rec->embedded;
+   rec->dtype = dtype;
 
+   info = rec->info;
    info->category = category;
-   info->subcategory = addrecord->subcategory;
-   adksys_clock_realtime(&info->timestamp);
-   addrecord->info = info;
+   info->subcategory = rec->subcategory;
+   if (ts)
+      info->timestamp = *ts;
+   else
+      adksys_clock_realtime(&info->timestamp);
 
-   if (!newrecord)
-      return addrecord;
+   change_log_append(shard, rec);
+}
 
-   addrecord->name = (const char *) strdup(name);
+/* Set name to value, creating the record if needed. Callers hold the
+   shard lock. */
+static record_list_t* record_nameval(record_shard_t *shard, const char *name, uint64_t hashval,
+                                     int category, const char *subcategory,
+                                     adiak_value_t *value, adiak_datatype_t *dtype,
+                                     const struct timespec *ts)
+{
+   record_list_t *addrecord = NULL;
 
-   addrecord->list_next = adiak_config->shared_record_list;
-   adiak_config->shared_record_list = addrecord;
+   addrecord = record_index_find(&shard->index, name, hashval);
+   if (!addrecord)
+      addrecord = new_record(shard, name, hashval);
+   if (!addrecord)
+      return NULL;
 
-   addrecord->hash_next = record_hash[hashval];
-   record_hash[hashval] = addrecord;
+   update_record(shard, addrecord, category, subcategory, value, dtype, ts);
 
    return addrecord;
 }
 
+static __thread staging_buffer_t *thread_staging_buffer;
+static __thread uint64_t thread_staging_epoch;
+
+static staging_buffer_t* get_staging_buffer()
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   uint64_t epoch = __atomic_load_n(&store->staging_epoch, __ATOMIC_RELAXED);
+   staging_buffer_t *buffer = thread_staging_buffer;
+
+   /* a buffer from before the last adiak_clean is gone */
+   if (buffer && thread_staging_epoch == epoch)
+      return buffer;
+
+   buffer = (staging_buffer_t *) malloc(sizeof(staging_buffer_t));
+   if (!buffer)
+      return NULL;
+   memset(buffer, 0, sizeof(*buffer));
+   buffer->id = __atomic_fetch_add(&store->num_staging_buffers, 1, __ATOMIC_RELAXED);
+
+   buffer->next = __atomic_load_n(&store->staging_buffers, __ATOMIC_ACQUIRE);
+   while (!__atomic_compare_exchange_n(&store->staging_buffers, &buffer->next, buffer, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+      ;
+
+   thread_staging_buffer = buffer;
+   thread_staging_epoch = epoch;
+   return buffer;
+}
+
+/* Copy str into the buffer's string storage and set *offset to its offset,
+   or to STAGED_NO_STRING if str is NULL. Returns -1 if the storage can't
+   grow. */
+static int stage_string(staging_buffer_t *buffer, const char *str, size_t *offset)
+{
+   size_t len;
+
+   if (!str) {
+      *offset = STAGED_NO_STRING;
+      return 0;
+   }
+
+   len = strlen(str) + 1;
+   if (buffer->strings_used + len > buffer->strings_capacity) {
+      size_t capacity = buffer->strings_capacity ? buffer->strings_capacity : 4096;
+      char *strings;
+      while (buffer->strings_used + len > capacity)
+         capacity *= 2;
+      strings = (char *) realloc(buffer->strings, capacity);
+      if (!strings)
+         return -1;
+      buffer->strings = strings;
+      buffer->strings_capacity = capacity;
+   }
+
+   *offset = buffer->strings_used;
+   memcpy(buffer->strings + *offset, str, len);
+   buffer->strings_used += len;
+   return 0;
+}
+
+/* Append a name/value to this thread's staging buffer. Like store_namevalue,
+   the top-level value is copied, and the value is freed on failure. */
+static int stage_namevalue(const char *name, int category, const char *subcategory,
+                           adiak_value_t *value, adiak_datatype_t *type)
+{
+   staging_buffer_t *buffer = get_staging_buffer();
+   staged_entry_t *entry;
+   size_t strings_used;
+
+   if (!buffer)
+      goto error;
+
+   if (buffer->count == buffer->capacity) {
+      size_t capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+      staged_entry_t *entries = (staged_entry_t *) realloc(buffer->entries, capacity * sizeof(staged_entry_t));
+      if (!entries)
+         goto error;
+      buffer->entries = entries;
+      buffer->capacity = capacity;
+   }
+
+   entry = buffer->entries + buffer->count;
+   strings_used = buffer->strings_used;
+   if (stage_string(buffer, name, &entry->name) == -1 ||
+       stage_string(buffer, subcategory, &entry->subcategory) == -1) {
+      buffer->strings_used = strings_used;
+      goto error;
+   }
+   entry->category = category;
+   entry->value = *value;
+   entry->dtype = type;
+   adksys_clock_realtime(&entry->timestamp);
+   buffer->count++;
+
+   return 0;
+
+error:
+   free_adiak_value_worker(type, value);
+   free_adiak_type(type);
+   return -1;
+}
+
+static void free_staged_entries(staging_buffer_t *buffer)
+{
+   size_t i;
+   for (i = 0; i < buffer->count; ++i) {
+      free_adiak_value_worker(buffer->entries[i].dtype, &buffer->entries[i].value);
+      free_adiak_type(buffer->entries[i].dtype);
+   }
+   buffer->count = 0;
+   buffer->strings_used = 0;
+}
+
+/* Free all staging buffers, including those of exited threads. Threads
+   that stage again get a new buffer. */
+static void free_staging_buffers(record_store_t *store)
+{
+   staging_buffer_t *buffer, *next;
+
+   for (buffer = store->staging_buffers; buffer != NULL; buffer = next) {
+      next = buffer->next;
+      free_staged_entries(buffer);
+      free(buffer->entries);
+      free(buffer->strings);
+      free(buffer);
+   }
+   store->staging_buffers = NULL;
+   __atomic_add_fetch(&store->staging_epoch, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+   staging_buffer_t *buffer;
+   staged_entry_t *entry;
+} staged_ref_t;
+
+static int compare_staged_time(const staged_ref_t *a, const staged_ref_t *b)
+{
+   if (a->entry->timestamp.tv_sec != b->entry->timestamp.tv_sec)
+      return a->entry->timestamp.tv_sec < b->entry->timestamp.tv_sec ? -1 : 1;
+   if (a->entry->timestamp.tv_nsec != b->entry->timestamp.tv_nsec)
+      return a->entry->timestamp.tv_nsec < b->entry->timestamp.tv_nsec ? -1 : 1;
+   if (a->buffer->id != b->buffer->id)
+      return a->buffer->id < b->buffer->id ? -1 : 1;
+   return a->entry < b->entry ? -1 : (a->entry > b->entry ? 1 : 0);
+}
+
+static int compare_staged_time_cb(const void *a, const void *b)
+{
+   return compare_staged_time((const staged_ref_t *) a, (const staged_ref_t *) b);
+}
+
+static int compare_staged_name_time_cb(const void *a, const void *b)
+{
+   const staged_ref_t *ra = (const staged_ref_t *) a;
+   const staged_ref_t *rb = (const staged_ref_t *) b;
+   int c = strcmp(ra->buffer->strings + ra->entry->name, rb->buffer->strings + rb->entry->name);
+   return c != 0 ? c : compare_staged_time(ra, rb);
+}
+
+static const char* staged_string(staging_buffer_t *buffer, size_t offset)
+{
+   return offset == STAGED_NO_STRING ? NULL : buffer->strings + offset;
+}
+
+/* Move the contents of the staging buffers into detached, an array of
+   num_buffers buffers whose next points to the buffer they came from.
+   Values staged while the detached entries are merged, e.g. by tool
+   callbacks, go to the emptied buffers and are merged by the next sync.
+ */
+static void detach_staged_entries(record_store_t *store, staging_buffer_t *detached, size_t num_buffers)
+{
+   staging_buffer_t *buffer = store->staging_buffers;
+   size_t k;
+
+   for (k = 0; k < num_buffers; ++k, buffer = buffer->next) {
+      detached[k] = *buffer;
+      detached[k].next = buffer;
+      buffer->entries = NULL;
+      buffer->count = buffer->capacity = 0;
+      buffer->strings = NULL;
+      buffer->strings_used = buffer->strings_capacity = 0;
+   }
+}
+
+/* Give the detached storage back to its buffer for reuse, unless something
+   was staged since it was detached. */
+static void reattach_staged_storage(staging_buffer_t *detached)
+{
+   staging_buffer_t *buffer = detached->next;
+
+   if (!buffer->entries && !buffer->strings) {
+      buffer->entries = detached->entries;
+      buffer->capacity = detached->capacity;
+      buffer->strings = detached->strings;
+      buffer->strings_capacity = detached->strings_capacity;
+   } else {
+      free(detached->entries);
+      free(detached->strings);
+   }
+}
+
+int adiak_sync()
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   staging_buffer_t *buffer, *detached;
+   staged_ref_t *refs;
+   size_t total = 0, num_buffers = 0, n = 0, num_winners = 0, i, k;
+   int result = 0;
+
+   for (buffer = store->staging_buffers; buffer != NULL; buffer = buffer->next) {
+      total += buffer->count;
+      ++num_buffers;
+   }
+   if (total == 0)
+      return 0;
+
+   refs = (staged_ref_t *) malloc(total * sizeof(staged_ref_t));
+   detached = (staging_buffer_t *) malloc(num_buffers * sizeof(staging_buffer_t));
+   if (!refs || !detached) {
+      free(refs);
+      free(detached);
+      return -1;
+   }
+   detach_staged_entries(store, detached, num_buffers);
+   for (k = 0; k < num_buffers; ++k)
+      for (i = 0; i < detached[k].count; ++i, ++n) {
+         refs[n].buffer = detached + k;
+         refs[n].entry = detached[k].entries + i;
+      }
+
+   /* Last writer wins: keep the latest entry for each name and drop the rest */
+   qsort(refs, total, sizeof(staged_ref_t), compare_staged_name_time_cb);
+   for (i = 0; i < total; ++i) {
+      staged_entry_t *entry = refs[i].entry;
+      if (i + 1 < total && strcmp(refs[i].buffer->strings + entry->name,
+                                  refs[i+1].buffer->strings + refs[i+1].entry->name) == 0) {
+         free_adiak_value_worker(entry->dtype, &entry->value);
+         free_adiak_type(entry->dtype);
+      } else {
+         refs[num_winners++] = refs[i];
+      }
+   }
+
+   /* Apply the surviving values in timestamp order so tools see a stable order */
+   qsort(refs, num_winners, sizeof(staged_ref_t), compare_staged_time_cb);
+   for (i = 0; i < num_winners; ++i) {
+      staged_entry_t *entry = refs[i].entry;
+      if (store_namevalue(staged_string(refs[i].buffer, entry->name), entry->category,
+                          staged_string(refs[i].buffer, entry->subcategory),
+                          &entry->value, entry->dtype, &entry->timestamp) != 0)
+         result = -1;
+   }
+
+   for (k = 0; k < num_buffers; ++k)
+      reattach_staged_storage(detached + k);
+
+   free(detached);
+   free(refs);
+   return result;
+}
+
+void adiak_set_thread_staging(int enable)
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   if (!enable && __atomic_exchange_n(&store->thread_staging, 0, __ATOMIC_RELAXED))
+      adiak_sync();
+   __atomic_store_n(&store->thread_staging, enable ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static void async_wait(int *spins)
+{
+   if (++*spins < LOCK_SPINS_BEFORE_YIELD)
+      adksys_yield();
+   else
+      adksys_sleep_us(ASYNC_IDLE_SLEEP_USEC);
+}
+
+/* Free the retired values whose tags the dispatcher has passed. Retired
+   values are appended roughly in tag order, so this stops at the first one
+   still in use.
+ */
+static void async_release_retired(async_dispatch_t *async, uint64_t head)
+{
+   retired_value_t *list, *last = NULL, *retired;
+
+   lock_acquire(&async->retired_lock);
+   list = async->retired;
+   for (retired = list; retired != NULL && retired->tag <= head; retired = retired->next)
+      last = retired;
+   if (last) {
+      async->retired = last->next;
+      if (!async->retired)
+         async->retired_last = NULL;
+      last->next = NULL;
+   } else {
+      list = NULL;
+   }
+   lock_release(&async->retired_lock);
+
+   while (list) {
+      retired = list->next;
+      free_adiak_value_worker(list->dtype, &list->value);
+      if (list->free_type)
+         free_adiak_type(list->dtype);
+      free(list);
+      list = retired;
+   }
+}
+
+/* Deliver up to max queued updates, in queue order. Callers hold the tool
+   lock, so there is one consumer at a time. Updates set by the callbacks
+   are reported right away, and a thread that is already delivering queued
+   updates doesn't start over, which would deliver the current one twice.
+ */
+static void async_deliver(record_store_t *store, uint64_t max)
+{
+   async_dispatch_t *async = &store->async;
+   uint64_t head = async->head;
+   async_entry_t *entry;
+   int spins = 0;
+
+   if (delivering_queued)
+      return;
+
+   delivering_queued = 1;
+   for (; max > 0 && head != __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE); --max) {
+      entry = async->entries + (head & (ASYNC_QUEUE_CAPACITY - 1));
+      /* the producer holds a shard lock while it fills the entry */
+      while (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE))
+         async_wait(&spins);
+      deliver_nameval(&store->dispatch, entry->name, entry->category, entry->info.subcategory,
+                      &entry->value, entry->dtype, entry->record, &entry->info);
+      __atomic_store_n(&entry->ready, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&async->head, ++head, __ATOMIC_RELEASE);
+   }
+   delivering_queued = 0;
+}
+
+#define ASYNC_RELEASE_INTERVAL 256
+
+static void *async_dispatcher(void *arg)
+{
+   record_store_t *store = (record_store_t *) arg;
+   async_dispatch_t *async = &store->async;
+   uint64_t head, delivered = 0;
+   int spins = 0;
+
+   for (;;) {
+      head = __atomic_load_n(&async->head, __ATOMIC_ACQUIRE);
+      if (head == __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE)) {
+         async_release_retired(async, head);
+         /* no updates are queued once running is cleared, but re-check the tail */
+         if (!__atomic_load_n(&async->running, __ATOMIC_ACQUIRE)
+             && head == __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE))
+            break;
+         async_wait(&spins);
+         continue;
+      }
+
+      /* take the tool lock for each update, so other threads get a turn */
+      spins = 0;
+      lock_acquire(&store->tool_lock);
+      async_deliver(store, 1);
+      lock_release(&store->tool_lock);
+
+      if (++delivered % ASYNC_RELEASE_INTERVAL == 0)
+         async_release_retired(async, __atomic_load_n(&async->head, __ATOMIC_ACQUIRE));
+   }
+
+   return NULL;
+}
+
+/* Deliver everything queued and stop the dispatcher thread. Updates set
+   afterwards are reported right away, after the queued ones: they wait for
+   the tool lock, which is held until producers that reserved a slot
+   before enabled was cleared have queued their update, and the queue is
+   drained.
+ */
+static void async_stop(record_store_t *store)
+{
+   async_dispatch_t *async = &store->async;
+   int spins = 0;
+
+   if (!async->thread)
+      return;
+
+   lock_acquire(&store->tool_lock);
+   __atomic_store_n(&async->enabled, 0, __ATOMIC_SEQ_CST);
+   while (__atomic_load_n(&async->reserved, __ATOMIC_SEQ_CST) != __atomic_load_n(&async->tail, __ATOMIC_SEQ_CST))
+      async_wait(&spins);
+   async_deliver(store, async->tail - async->head);
+   lock_release(&store->tool_lock);
+
+   __atomic_store_n(&async->running, 0, __ATOMIC_RELEASE);
+   adksys_thread_join(async->thread);
+   async->thread = NULL;
+   async_release_retired(async, async->head);
+}
+
+int adiak_set_async_dispatch(int enable)
+{
+   record_store_t *store = get_record_store(adiak_get_config());
+   async_dispatch_t *async = &store->async;
+
+   if (!enable) {
+      async_stop(store);
+      return 0;
+   }
+   if (async->thread)
+      return 0;
+
+   if (!async->entries) {
+      async->entries = (async_entry_t *) calloc(ASYNC_QUEUE_CAPACITY, sizeof(async_entry_t));
+      if (!async->entries)
+         return -1;
+   }
+
+   __atomic_store_n(&async->running, 1, __ATOMIC_RELEASE);
+   async->thread = adksys_thread_start(async_dispatcher, store);
+   if (!async->thread) {
+      __atomic_store_n(&async->running, 0, __ATOMIC_RELEASE);
+      return -1;
+   }
+
+   lock_acquire(&store->tool_lock);
+   __atomic_store_n(&async->enabled, 1, __ATOMIC_RELEASE);
+   lock_release(&store->tool_lock);
+   return 0;
+}
+
 int adiak_flush(const char *location)
 {
    adiak_value_t val;
+   adiak_sync();
    val.v_ptr = (void *) location;
    return adiak_raw_namevalue("flush", adiak_control, NULL, &val, &base_path);
 }
@@ -1136,35 +4919,62 @@ int adiak_clean()
 {
    adiak_value_t val;
    record_list_t *i, *next;
-   int result;
+   size_t position, count;
+   int result, n;
 
    adiak_t* adiak_config = adiak_get_config();
 
    val.v_int = 0;
    result = adiak_raw_namevalue("clean", adiak_control, NULL, &val, &base_int);
+
+   record_store_t* store = get_record_store(adiak_config);
+   async_stop(store);
+   free(store->async.entries);
+   store->async.entries = NULL;
+   free_staging_buffers(store);
+
+   count = __atomic_load_n(&store->table.count, __ATOMIC_ACQUIRE);
+   for (position = 0; position < count; ++position) {
+      i = record_table_get(&store->table, position);
+      if (i) {
+         free_record_value(i);
+         free_adiak_type(i->dtype);
+      }
+   }
+
+   /* records of older library copies, allocated as those copies do */
    for (i = adiak_config->shared_record_list; i != NULL; i = next) {
-      free_adiak_value(i->dtype, i->value);
+      free_record_value(i);
       free_adiak_type(i->dtype);
       free((void *) i->name);
       free((void *) i->info);
-      if (i->subcategory)
-         free((void *) i->subcategory);
+      free((void *) i->subcategory);
       next = i->list_next;
       free(i);
    }
-
-   record_list_t** record_hash = local_record_hash;
    if (adiak_config->minimum_version >= 1)
-      record_hash = adiak_config->record_hash;
+      memset(adiak_config->record_hash, 0, sizeof(adiak_config->record_hash));
 
-   memset(record_hash, 0, sizeof(local_record_hash));
+   for (n = 0; n < RECORD_SHARDS; ++n) {
+      record_index_clear(&store->records[n].index);
+      arena_free_all(&store->records[n].arena);
+      change_log_clear(&store->records[n].changes);
+   }
+   record_table_clear(&store->table);
+   category_index_clear(&store->categories);
+   type_cache_clear(&store->types);
+   for (n = 0; n < VALUE_BLOCK_SHARDS; ++n)
+      value_block_set_clear(&store->value_blocks[n].set);
+   for (n = 0; n < STRING_SHARDS; ++n)
+      string_pool_clear(&store->strings[n].pool);
    adiak_config->shared_record_list = NULL;
 
+   tool_dispatch_clear(&store->dispatch);
    if (adiak_config->tool_list != NULL) {
       adiak_tool_t* next_tool = NULL;
       for (adiak_tool_t* tool = (*adiak_config->tool_list); tool != NULL; tool = next_tool) {
          next_tool = tool->next;
-         free(tool);
+         free_tool(tool);
       }
       adiak_config->tool_list = NULL;
    }
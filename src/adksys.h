@@ -17,6 +17,10 @@ int adksys_mpi_init(void *mpi_communicator_p);
 int adksys_get_times(struct timeval *sys, struct timeval *cpu);
 int adksys_curtime(struct timeval *tm);
 int adksys_clock_realtime(struct timespec* ts);
+void adksys_yield();
+void adksys_sleep_us(long usec);
+void *adksys_thread_start(void *(*fn)(void *), void *arg);
+void adksys_thread_join(void *thread);
 int adksys_hostname(char *outbuffer, int buffer_size);
 int adksys_starttime(struct timeval *tv);
 int adksys_get_executable(char *outpath, size_t outpath_size);
@@ -10,6 +10,9 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdlib.h>
 
 #include "adksys.h"
 
@@ -50,6 +53,33 @@ int adksys_clock_realtime(struct timespec *ts) {
    return clock_gettime(CLOCK_REALTIME, ts);
 }
 
+void adksys_yield() {
+   sched_yield();
+}
+
+void adksys_sleep_us(long usec) {
+   struct timespec ts;
+   ts.tv_sec = usec / 1000000;
+   ts.tv_nsec = (usec % 1000000) * 1000;
+   nanosleep(&ts, NULL);
+}
+
+void *adksys_thread_start(void *(*fn)(void *), void *arg) {
+   pthread_t *thread = (pthread_t *) malloc(sizeof(pthread_t));
+   if (!thread)
+      return NULL;
+   if (pthread_create(thread, NULL, fn, arg) != 0) {
+      free(thread);
+      return NULL;
+   }
+   return thread;
+}
+
+void adksys_thread_join(void *thread) {
+   pthread_join(*((pthread_t *) thread), NULL);
+   free(thread);
+}
+
 int adksys_hostname(char *outbuffer, int buffer_size)
 {
    int result = gethostname(outbuffer, buffer_size);
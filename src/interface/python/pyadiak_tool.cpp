@@ -110,9 +110,13 @@ py::object convert_adiak_value_to_python(adiak_value_t *val,
       throw std::runtime_error(
           "Mismatch in Adiak between 'range' type and number of subtypes");
     }
+    adiak_datatype_t *subtypes[2];
+    adiak_value_t subvals[2];
+    adiak_get_subval(type, val, 0, &subtypes[0], &subvals[0]);
+    adiak_get_subval(type, val, 1, &subtypes[1], &subvals[1]);
     std::tuple<py::object, py::object> range_tuple = std::make_tuple(
-        convert_adiak_value_to_python(&(val->v_subval[0]), type->subtype[0]),
-        convert_adiak_value_to_python(&(val->v_subval[1]), type->subtype[1]));
+        convert_adiak_value_to_python(&subvals[0], subtypes[0]),
+        convert_adiak_value_to_python(&subvals[1], subtypes[1]));
     return py::cast(range_tuple);
     break;
   }
@@ -121,13 +125,13 @@ py::object convert_adiak_value_to_python(adiak_value_t *val,
       throw std::runtime_error(
           "Mismatch in Adiak between 'set' type and number of subtypes");
     }
-    adiak_datatype_t *subtype = type->subtype[0];
-    int num_elems =
-        type->is_reference != 0 ? type->num_ref_elements : type->num_elements;
+    adiak_datatype_t *subtype;
+    adiak_value_t subval;
+    int num_elems = adiak_num_subvals(type);
     std::set<py::object> set_val;
     for (int i = 0; i < num_elems; i++) {
-      set_val.insert(
-          convert_adiak_value_to_python(&(val->v_subval[i]), subtype));
+      adiak_get_subval(type, val, i, &subtype, &subval);
+      set_val.insert(convert_adiak_value_to_python(&subval, subtype));
     }
     return py::cast(set_val);
     break;
@@ -137,29 +141,30 @@ py::object convert_adiak_value_to_python(adiak_value_t *val,
       throw std::runtime_error(
           "Mismatch in Adiak between 'list' type and number of subtypes");
     }
-    adiak_datatype_t *subtype = type->subtype[0];
-    int num_elems =
-        type->is_reference != 0 ? type->num_ref_elements : type->num_elements;
+    adiak_datatype_t *subtype;
+    adiak_value_t subval;
+    int num_elems = adiak_num_subvals(type);
     std::vector<py::object> list_val;
     for (int i = 0; i < num_elems; i++) {
-      list_val.push_back(
-          convert_adiak_value_to_python(&(val->v_subval[i]), subtype));
+      adiak_get_subval(type, val, i, &subtype, &subval);
+      list_val.push_back(convert_adiak_value_to_python(&subval, subtype));
     }
     return py::cast(list_val);
     break;
   }
   case adiak_tuple: {
     int num_subtypes = type->num_subtypes;
-    int num_elems =
-        type->is_reference != 0 ? type->num_ref_elements : type->num_elements;
+    int num_elems = adiak_num_subvals(type);
     if (num_subtypes != num_elems) {
       throw std::runtime_error(
           "Mismatch in Adiak between 'tuple' type and number of subtypes");
     }
+    adiak_datatype_t *subtype;
+    adiak_value_t subval;
     std::vector<py::object> list_val;
     for (int i = 0; i < num_elems; i++) {
-      list_val.push_back(
-          convert_adiak_value_to_python(&(val->v_subval[i]), type->subtype[i]));
+      adiak_get_subval(type, val, i, &subtype, &subval);
+      list_val.push_back(convert_adiak_value_to_python(&subval, subtype));
     }
     py::tuple tup_val = py::cast(list_val);
     return tup_val;
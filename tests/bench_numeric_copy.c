@@ -0,0 +1,83 @@
+// Copyright 2019 Lawrence Livermore National Security, LLC
+// See the top-level COPYRIGHT file for details.
+//
+// SPDX-License-Identifier: MIT
+
+/* Measures the cost of copying numeric lists of 1,000 to 10,000,000
+ * elements. "packed" lists are stored at their native width; "widened"
+ * lists are nested in a tuple and converted to one adiak_value_t per
+ * element.
+ */
+
+#include "adiak_tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_ELEMENTS 10000000
+#define ELEMENTS_PER_SIZE 100000000
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void ignore_nameval(const char *name, int category, const char *subcategory,
+                           adiak_value_t *value, adiak_datatype_t *t, void *opaque_value)
+{
+   (void) name; (void) category; (void) subcategory; (void) value; (void) t; (void) opaque_value;
+}
+
+/* Returns ns per element for copying a list of n elements. */
+static double time_copy(const char *typestr, int is_nested, void *data, int n)
+{
+   int reps = ELEMENTS_PER_SIZE / n, i;
+   double t0 = now();
+
+   for (i = 0; i < reps; ++i) {
+      if (is_nested)
+         adiak_namevalue("bench.numeric", adiak_performance, NULL, typestr, data, 1, n);
+      else
+         adiak_namevalue("bench.numeric", adiak_performance, NULL, typestr, data, n);
+   }
+
+   return (now() - t0) * 1e9 / ((double) reps * n);
+}
+
+int main(int argc, char *argv[])
+{
+   static const char *types[] = { "%f32", "%f", "%i8", "%d" };
+   char packed[16], widened[16];
+   unsigned char *data;
+   int n, t, i;
+
+   (void) argc;
+   (void) argv;
+
+   data = (unsigned char *) malloc(MAX_ELEMENTS * sizeof(double));
+   for (i = 0; i < MAX_ELEMENTS; ++i)
+      ((double *) data)[i] = i;
+
+   adiak_init(NULL);
+   /* lists are only packed once a tool registered with adiak_version 2 */
+   adiak_register_cb(2, adiak_control, ignore_nameval, 0, NULL);
+
+   printf("%6s %10s %14s %14s\n", "type", "elements", "packed ns/el", "widened ns/el");
+
+   for (t = 0; t < (int) (sizeof(types) / sizeof(types[0])); ++t) {
+      snprintf(packed, sizeof(packed), "{%s}", types[t]);
+      snprintf(widened, sizeof(widened), "({%s})", types[t]);
+      for (n = 1000; n <= MAX_ELEMENTS; n *= 10) {
+         double p = time_copy(packed, 0, data, n);
+         double w = time_copy(widened, 1, data, n);
+         printf("%6s %10d %14.3f %14.3f\n", types[t], n, p, w);
+      }
+   }
+
+   adiak_fini();
+   free(data);
+   return 0;
+}
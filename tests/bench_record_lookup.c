@@ -0,0 +1,77 @@
+// Copyright 2019 Lawrence Livermore National Security, LLC
+// See the top-level COPYRIGHT file for details.
+//
+// SPDX-License-Identifier: MIT
+
+/* Measures the cost of looking up a record by name as the number of
+ * registered records grows from 10 to 1,000,000. The per-lookup cost
+ * should stay roughly flat.
+ */
+
+#include "adiak_tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_RECORDS 1000000
+#define NUM_LOOKUPS 1000000
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_name(char *buf, size_t len, int i)
+{
+   snprintf(buf, len, "kernel.phase_%d.time", i);
+}
+
+int main(int argc, char *argv[])
+{
+   char name[64];
+   int num_records = 0;
+   int target, i;
+   unsigned int seed = 42;
+   adiak_value_t *value;
+   adiak_datatype_t *dtype;
+
+   (void) argc;
+   (void) argv;
+
+   adiak_init(NULL);
+
+   printf("%10s %14s %14s\n", "records", "insert ns/op", "lookup ns/op");
+
+   for (target = 10; target <= MAX_RECORDS; target *= 10) {
+      double t0 = now();
+      for ( ; num_records < target; ++num_records) {
+         make_name(name, sizeof(name), num_records);
+         adiak_namevalue(name, adiak_performance, NULL, "%d", num_records);
+      }
+      double t1 = now();
+      int inserted = target == 10 ? 10 : target - target / 10;
+
+      long found = 0;
+      double t2 = now();
+      for (i = 0; i < NUM_LOOKUPS; ++i) {
+         make_name(name, sizeof(name), rand_r(&seed) % num_records);
+         if (adiak_get_nameval(name, &dtype, &value, NULL, NULL) == 0)
+            ++found;
+      }
+      double t3 = now();
+
+      if (found != NUM_LOOKUPS) {
+         fprintf(stderr, "lookup failed: found %ld of %d\n", found, NUM_LOOKUPS);
+         return 1;
+      }
+
+      printf("%10d %14.1f %14.1f\n", num_records,
+             (t1 - t0) * 1e9 / inserted, (t3 - t2) * 1e9 / NUM_LOOKUPS);
+   }
+
+   adiak_fini();
+   return 0;
+}
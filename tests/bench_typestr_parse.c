@@ -0,0 +1,101 @@
+// Copyright 2019 Lawrence Livermore National Security, LLC
+// See the top-level COPYRIGHT file for details.
+//
+// SPDX-License-Identifier: MIT
+
+/* Measures type string parsing for deeply nested containers and wide
+ * tuples of growing size. The per-character cost should stay roughly flat.
+ * Repeated type strings are found in the type cache, but each call still
+ * parses the type string once to read its element counts.
+ */
+
+#include "adiak_tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_SIZE 512
+#define NUM_PARSES 2000
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* "<<<...%d...>>>" nested n deep; ranges take no counts */
+static void make_nested(char *buf, int n)
+{
+   int i;
+   for (i = 0; i < n; ++i)
+      buf[i] = '<';
+   strcpy(buf + n, "%d");
+   for (i = 0; i < n; ++i)
+      buf[n + 2 + i] = '>';
+   buf[2 * n + 2] = '\0';
+}
+
+/* "(%d,%d,...,%d)" with n elements; takes one count */
+static void make_wide(char *buf, int n)
+{
+   int i, pos = 0;
+   buf[pos++] = '(';
+   for (i = 0; i < n; ++i) {
+      if (i)
+         buf[pos++] = ',';
+      buf[pos++] = '%';
+      buf[pos++] = 'd';
+   }
+   buf[pos++] = ')';
+   buf[pos] = '\0';
+}
+
+int main(int argc, char *argv[])
+{
+   static char typestr[4 * MAX_SIZE + 8];
+   int n, i;
+   adiak_datatype_t *t;
+
+   (void) argc;
+   (void) argv;
+
+   adiak_init(NULL);
+
+   printf("%8s %18s %18s\n", "size", "nested ns/char", "tuple ns/char");
+
+   for (n = 4; n <= MAX_SIZE; n *= 2) {
+      double t0, t1, t2;
+
+      make_nested(typestr, n);
+      t0 = now();
+      for (i = 0; i < NUM_PARSES; ++i) {
+         t = adiak_new_datatype(typestr);
+         if (!t) {
+            fprintf(stderr, "parse failed: %s\n", adiak_get_typestr_error(NULL));
+            return 1;
+         }
+      }
+      t1 = now();
+      double nested = (t1 - t0) * 1e9 / NUM_PARSES / strlen(typestr);
+
+      make_wide(typestr, n);
+      t1 = now();
+      for (i = 0; i < NUM_PARSES; ++i) {
+         t = adiak_new_datatype(typestr, n);
+         if (!t) {
+            fprintf(stderr, "parse failed: %s\n", adiak_get_typestr_error(NULL));
+            return 1;
+         }
+      }
+      t2 = now();
+      double wide = (t2 - t1) * 1e9 / NUM_PARSES / strlen(typestr);
+
+      printf("%8d %18.2f %18.2f\n", n, nested, wide);
+   }
+
+   adiak_fini();
+   return 0;
+}
@@ -146,6 +146,48 @@ TEST(AdiakApplicationAPI, CXX_CompoundTypes)
     EXPECT_EQ(inner_subval.v_int, 3);
 }
 
+TEST(AdiakApplicationAPI, CXX_SharedTypes)
+{
+    std::vector<double> v_a { 1.0, 2.0, 3.0 };
+    std::vector<double> v_b { 4.0, 5.0, 6.0 };
+    std::vector<std::vector<int>> v_nested { { 1, 2 }, { 3, 4 } };
+
+    EXPECT_TRUE(adiak::value("cxx:shared:a", v_a));
+    EXPECT_TRUE(adiak::value("cxx:shared:b", v_b));
+    EXPECT_TRUE(adiak::value("cxx:shared:tpl:a", std::make_tuple(1, 2.0)));
+    EXPECT_TRUE(adiak::value("cxx:shared:tpl:b", std::make_tuple(3, 4.0)));
+    EXPECT_TRUE(adiak::value("cxx:shared:nested", v_nested));
+
+    adiak_datatype_t* dtype_a = nullptr;
+    adiak_datatype_t* dtype_b = nullptr;
+    adiak_value_t* val = nullptr;
+
+    // values of the same C++ type and size share one datatype
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:a", &dtype_a, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:b", &dtype_b, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype_a, dtype_b);
+    EXPECT_EQ(dtype_a->num_elements, 3);
+    EXPECT_DOUBLE_EQ(val->v_subval[2].v_double, 6.0);
+
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:tpl:a", &dtype_a, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:tpl:b", &dtype_b, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype_a, dtype_b);
+    EXPECT_EQ(dtype_a->subtype[1]->dtype, adiak_type_t::adiak_double);
+
+    // a different size gets its own datatype
+    v_b.push_back(7.0);
+    EXPECT_TRUE(adiak::value("cxx:shared:b", v_b));
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:a", &dtype_a, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:b", &dtype_b, &val, nullptr, nullptr), 0);
+    EXPECT_NE(dtype_a, dtype_b);
+    EXPECT_EQ(dtype_a->num_elements, 3);
+    EXPECT_EQ(dtype_b->num_elements, 4);
+
+    EXPECT_EQ(adiak_get_nameval("cxx:shared:nested", &dtype_a, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype_a->num_elements, 2);
+    EXPECT_EQ(dtype_a->subtype[0]->num_elements, 2);
+}
+
 bool operator <= (const struct timespec& a, const struct timespec& b)
 {
     return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec <= b.tv_nsec);
@@ -529,4 +571,141 @@ TEST(AdiakApplicationAPI, C_ZeroCopyTypes)
     EXPECT_EQ(inner_subtype->dtype, adiak_type_t::adiak_string);
     EXPECT_EQ(inner_subtype->is_reference, 1);
     EXPECT_EQ(inner_subval.v_ptr, s_hello_data[1].str);
-}
\ No newline at end of file
+}
+
+// Numeric lists and sets are only packed once a tool registered with
+// adiak_version 2.
+static void request_packed_arrays()
+{
+    static bool requested = false;
+    if (!requested)
+        adiak_register_cb(2, 4343, [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {},
+                          0, nullptr);
+    requested = true;
+}
+
+TEST(AdiakApplicationAPI, C_PackedArrays)
+{
+    static int ref_flags[2];
+    static double third[2];
+    const float f32s[3] = { 1.5f, 2.5f, 3.5f };
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+
+    // no tool asked for packed arrays yet
+    EXPECT_EQ(adiak_namevalue("packed:before", adiak_general, NULL, "{%f32}", f32s, 3), 0);
+    EXPECT_EQ(adiak_get_nameval("packed:before", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->is_reference, 0);
+
+    // a version 1 tool gets packed values unpacked, and so does a version 1 listing
+    adiak_register_cb(1, 4344, [](const char*, int, const char*, adiak_value_t* v, adiak_datatype_t* t, void*) {
+                          ref_flags[0] = t->is_reference;
+                          third[0] = v->v_subval[2].v_double;
+                      }, 0, nullptr);
+    request_packed_arrays();
+    EXPECT_EQ(adiak_namevalue("packed:after", 4344, NULL, "{%f32}", f32s, 3), 0);
+    EXPECT_EQ(adiak_get_nameval("packed:after", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->is_reference, 2);
+    EXPECT_EQ(ref_flags[0], 0);
+    EXPECT_DOUBLE_EQ(third[0], 3.5);
+
+    adiak_list_namevals(1, 4344, [](const char*, int, const char*, adiak_value_t* v, adiak_datatype_t* t, void*) {
+                            ref_flags[1] = t->is_reference;
+                            third[1] = v->v_subval[2].v_double;
+                        }, nullptr);
+    EXPECT_EQ(ref_flags[1], 0);
+    EXPECT_DOUBLE_EQ(third[1], 3.5);
+
+    // values set before stay as they are
+    EXPECT_EQ(adiak_get_nameval("packed:before", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->is_reference, 0);
+}
+
+TEST(AdiakApplicationAPI, C_NameValueTake)
+{
+    request_packed_arrays();
+
+    char* json = strdup("{ \"taken\": true }");
+    double* samples = static_cast<double*>(malloc(4 * sizeof(double)));
+    for (int i = 0; i < 4; ++i)
+        samples[i] = 0.5 * i;
+    const char** strings = static_cast<const char**>(malloc(2 * sizeof(char*)));
+    strings[0] = "a";
+    strings[1] = "b";
+    struct timeval* tv = static_cast<struct timeval*>(malloc(sizeof(struct timeval)));
+    tv->tv_sec = 42;
+    tv->tv_usec = 0;
+
+    EXPECT_EQ(adiak_namevalue_take("take:json", adiak_general, NULL, "%j", json), 0);
+    EXPECT_EQ(adiak_namevalue_take("take:samples", adiak_general, NULL, "{%f}", samples, 4), 0);
+    EXPECT_EQ(adiak_namevalue_take("take:strings", adiak_general, NULL, "{%s}", strings, 2), 0);
+    EXPECT_EQ(adiak_namevalue_take("take:cat", adiak_general, NULL, "%r", strdup("category")), 0);
+    EXPECT_EQ(adiak_namevalue_take("take:timeval", adiak_general, NULL, "%t", tv), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    adiak_datatype_t* subtype = nullptr;
+    adiak_value_t subval;
+
+    // strings and numeric lists are stored without a copy
+    EXPECT_EQ(adiak_get_nameval("take:json", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_ptr, json);
+    EXPECT_EQ(adiak_get_nameval("take:samples", &dtype, &val, nullptr, nullptr), 0);
+    void* ptr = nullptr;
+    int count = 0;
+    EXPECT_EQ(adiak_get_array(dtype, val, &ptr, &count, nullptr), 0);
+    EXPECT_EQ(ptr, samples);
+    EXPECT_EQ(count, 4);
+    EXPECT_EQ(adiak_get_nameval("take:timeval", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_ptr, tv);
+
+    EXPECT_EQ(adiak_get_nameval("take:strings", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 1, &subtype, &subval), 0);
+    EXPECT_STREQ(static_cast<const char*>(subval.v_ptr), "b");
+    EXPECT_EQ(adiak_get_nameval("take:cat", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "category");
+
+    // references can't be taken over; the caller keeps ownership
+    char* ref = strdup("reference");
+    EXPECT_EQ(adiak_namevalue_take("take:ref", adiak_general, NULL, "&%s", ref), -1);
+    free(ref);
+
+    // overwriting taken values frees them
+    EXPECT_EQ(adiak_namevalue_take("take:json", adiak_general, NULL, "%j", strdup("{}")), 0);
+    EXPECT_EQ(adiak_namevalue("take:samples", adiak_general, NULL, "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("take:timeval", adiak_general, NULL, "%d", 1), 0);
+}
+
+TEST(AdiakApplicationAPI, CXX_MoveValues)
+{
+    request_packed_arrays();
+
+    std::vector<float> floats { 1.5f, 2.5f, 3.5f };
+    std::string str("moved string");
+    std::vector<std::string> strings { "a", "b" };
+
+    EXPECT_TRUE(adiak::value("cxx:move:floats", std::move(floats)));
+    EXPECT_TRUE(adiak::value("cxx:move:string", std::move(str)));
+    EXPECT_TRUE(adiak::value("cxx:move:strings", std::move(strings)));
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_datatype_t* elem_type = nullptr;
+    adiak_value_t* val = nullptr;
+    void* ptr = nullptr;
+    int count = 0;
+
+    // moved numeric vectors are stored packed at their native width
+    EXPECT_EQ(adiak_get_nameval("cxx:move:floats", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_list);
+    ASSERT_EQ(adiak_get_array(dtype, val, &ptr, &count, &elem_type), 0);
+    EXPECT_EQ(count, 3);
+    EXPECT_EQ(elem_type->num_bytes, sizeof(float));
+    EXPECT_EQ(static_cast<float*>(ptr)[2], 3.5f);
+
+    EXPECT_EQ(adiak_get_nameval("cxx:move:string", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_string);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "moved string");
+
+    EXPECT_EQ(adiak_get_nameval("cxx:move:strings", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_num_subvals(dtype), 2);
+}
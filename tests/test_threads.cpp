@@ -0,0 +1,319 @@
+#include <gtest/gtest.h>
+
+#include "adiak.hpp"
+#include "adiak_tool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const int kNamesPerThread = 2000;
+const int kUpdatesPerName = 5;
+
+template <typename F>
+double run_threads(int num_threads, F fn)
+{
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back(fn, t);
+    for (auto& th : threads)
+        th.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string thread_name(const char* prefix, int nthreads, int t, int i)
+{
+    return std::string(prefix) + std::to_string(nthreads) + "." + std::to_string(t) + "." + std::to_string(i);
+}
+
+std::atomic<int> in_callback(0);
+std::atomic<int> overlapping_callbacks(0);
+long num_callbacks = 0; // only written from (serialized) tool callbacks
+
+void counting_cb(const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*)
+{
+    if (in_callback.fetch_add(1) != 0)
+        ++overlapping_callbacks;
+    ++num_callbacks;
+    in_callback.fetch_sub(1);
+}
+
+}
+
+// Many threads registering distinct names. Prints throughput for increasing
+// thread counts.
+TEST(AdiakThreads, DistinctNames)
+{
+    const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        double secs = run_threads(nthreads, [nthreads](int t) {
+            for (int i = 0; i < kNamesPerThread; ++i) {
+                std::string name = thread_name("distinct.", nthreads, t, i);
+                for (int u = 0; u < kUpdatesPerName; ++u)
+                    adiak_namevalue(name.c_str(), adiak_performance, "threads", "%d", i * kUpdatesPerName + u);
+            }
+        });
+
+        long ops = static_cast<long>(nthreads) * kNamesPerThread * kUpdatesPerName;
+        std::printf("%3d threads: %8.2f Mops/s\n", nthreads, ops / secs * 1e-6);
+
+        for (int t = 0; t < nthreads; ++t)
+            for (int i = 0; i < kNamesPerThread; i += 97) {
+                adiak_value_t* val = nullptr;
+                adiak_datatype_t* dtype = nullptr;
+                std::string name = thread_name("distinct.", nthreads, t, i);
+                ASSERT_EQ(adiak_get_nameval(name.c_str(), &dtype, &val, nullptr, nullptr), 0) << name;
+                EXPECT_EQ(val->v_int, i * kUpdatesPerName + kUpdatesPerName - 1);
+            }
+    }
+}
+
+// All threads hammer the same few names with heap-allocated values.
+TEST(AdiakThreads, SharedNames)
+{
+    run_threads(8, [](int t) {
+        adiak_name_handle_t h = adiak_get_handle("shared.handle", adiak_general, nullptr, "%s");
+        for (int i = 0; i < 2000; ++i) {
+            std::string s = std::to_string(t) + ":" + std::to_string(i);
+            adiak_namevalue("shared.string", adiak_general, "threads", "%s", s.c_str());
+            adiak_namevalue("shared.cat", adiak_general, "threads", "%r", (i % 2) ? "odd" : "even");
+            adiak_update_handle(h, s.c_str());
+            adiak::value("shared.double", static_cast<double>(i));
+        }
+    });
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    EXPECT_EQ(adiak_get_nameval("shared.string", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_string);
+    EXPECT_EQ(adiak_get_nameval("shared.handle", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_string);
+    EXPECT_EQ(adiak_get_nameval("shared.double", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_DOUBLE_EQ(val->v_double, 1999.0);
+}
+
+// Tool callbacks never run concurrently and see every update.
+TEST(AdiakThreads, SerializedToolCallbacks)
+{
+    adiak_register_cb(1, adiak_performance, counting_cb, 0, nullptr);
+
+    const int nthreads = 8;
+    const int n = 1000;
+    run_threads(nthreads, [](int t) {
+        for (int i = 0; i < n; ++i) {
+            std::string name = thread_name("tool.", nthreads, t, i % 10);
+            adiak_namevalue(name.c_str(), adiak_performance, nullptr, "%d", i);
+        }
+    });
+
+    EXPECT_EQ(num_callbacks, static_cast<long>(nthreads) * n);
+    EXPECT_EQ(overlapping_callbacks.load(), 0);
+
+    int num_listed = 0;
+    adiak_list_namevals(1, adiak_performance,
+                        [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void* p) {
+                            ++*static_cast<int*>(p);
+                        }, &num_listed);
+    EXPECT_GE(num_listed, nthreads * 10);
+}
+
+// Staged updates are invisible until adiak_sync, and the latest one wins.
+TEST(AdiakThreads, ThreadStaging)
+{
+    adiak_set_thread_staging(1);
+
+    const int nthreads = 4;
+    run_threads(nthreads, [](int t) {
+        for (int i = 0; i < 1000; ++i) {
+            adiak_namevalue("staged.shared", adiak_general, "staging", "%d", t * 1000 + i);
+            std::string name = thread_name("staged.", nthreads, t, 0);
+            adiak_namevalue(name.c_str(), adiak_general, nullptr, "%s", std::to_string(i).c_str());
+        }
+    });
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    EXPECT_EQ(adiak_get_nameval("staged.shared", &dtype, &val, nullptr, nullptr), -1);
+
+    // a later update from a new thread wins
+    std::thread([&]() {
+        adiak_namevalue("staged.shared", adiak_general, "staging", "%d", -1);
+    }).join();
+
+    EXPECT_EQ(adiak_sync(), 0);
+    adiak_set_thread_staging(0);
+
+    const char* subcat = nullptr;
+    EXPECT_EQ(adiak_get_nameval("staged.shared", &dtype, &val, nullptr, &subcat), 0);
+    EXPECT_EQ(val->v_int, -1);
+    EXPECT_STREQ(subcat, "staging");
+
+    for (int t = 0; t < nthreads; ++t) {
+        std::string name = thread_name("staged.", nthreads, t, 0);
+        EXPECT_EQ(adiak_get_nameval(name.c_str(), &dtype, &val, nullptr, nullptr), 0);
+        EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "999");
+    }
+
+    // staging is off again: updates are visible immediately
+    EXPECT_EQ(adiak_namevalue("staged.shared", adiak_general, nullptr, "%d", 7), 0);
+    EXPECT_EQ(adiak_get_nameval("staged.shared", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_int, 7);
+}
+
+// Values staged by a tool callback during adiak_sync are kept for the next
+// sync.
+TEST(AdiakThreads, StagingDuringSync)
+{
+    const int cat = 7890;
+    adiak_register_cb(1, cat,
+                      [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                          if (std::string(name) != "sync.trigger")
+                              return;
+                          // enough to grow the staging buffer's storage
+                          for (int i = 0; i < 500; ++i)
+                              adiak_namevalue(("sync.callback." + std::to_string(i)).c_str(), adiak_general,
+                                              nullptr, "%d", i);
+                      }, 0, nullptr);
+
+    adiak_set_thread_staging(1);
+    for (int i = 0; i < 100; ++i)
+        adiak_namevalue(("sync.staged." + std::to_string(i)).c_str(), adiak_general, nullptr, "%d", i);
+    adiak_namevalue("sync.trigger", cat, nullptr, "%d", 1);
+    EXPECT_EQ(adiak_sync(), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    EXPECT_EQ(adiak_get_nameval("sync.staged.99", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_int, 99);
+    EXPECT_EQ(adiak_get_nameval("sync.callback.0", &dtype, &val, nullptr, nullptr), -1);
+
+    adiak_set_thread_staging(0);
+    for (int i : { 0, 499 }) {
+        EXPECT_EQ(adiak_get_nameval(("sync.callback." + std::to_string(i)).c_str(), &dtype, &val, nullptr, nullptr), 0);
+        EXPECT_EQ(val->v_int, i);
+    }
+}
+
+// Async dispatch reports every update in order on another thread, and
+// adiak_flush waits for it.
+TEST(AdiakThreads, AsyncDispatch)
+{
+    static std::vector<std::string> received;
+    static std::atomic<int> on_app_thread(0);
+    static std::thread::id app_thread;
+
+    app_thread = std::this_thread::get_id();
+    adiak_register_cb(1, 4321,
+                      [](const char*, int, const char*, adiak_value_t* val, adiak_datatype_t*, void*) {
+                          if (received.empty())
+                              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                          if (std::this_thread::get_id() == app_thread)
+                              ++on_app_thread;
+                          received.emplace_back(static_cast<const char*>(val->v_ptr));
+                      }, 0, nullptr);
+
+    ASSERT_EQ(adiak_set_async_dispatch(1), 0);
+
+    // more updates than the queue holds; each replaces the previous value
+    const int n = 10000;
+    for (int i = 0; i < n; ++i)
+        adiak_namevalue("async.string", 4321, nullptr, "%s", std::to_string(i).c_str());
+
+    EXPECT_EQ(adiak_flush(""), 0);
+    ASSERT_EQ(received.size(), static_cast<size_t>(n));
+    for (int i = 0; i < n; ++i)
+        EXPECT_EQ(received[i], std::to_string(i));
+    EXPECT_EQ(on_app_thread.load(), 0);
+
+    // disabled again: reported synchronously
+    EXPECT_EQ(adiak_set_async_dispatch(0), 0);
+    adiak_namevalue("async.string", 4321, nullptr, "%s", "sync");
+    ASSERT_EQ(received.size(), static_cast<size_t>(n + 1));
+    EXPECT_EQ(received.back(), "sync");
+    EXPECT_EQ(on_app_thread.load(), 1);
+}
+
+// Listing doesn't overlap with callbacks run by the dispatcher thread.
+TEST(AdiakThreads, AsyncListSerialized)
+{
+    static std::atomic<long> num_async(0);
+    static long num_listed = 0;
+
+    adiak_register_cb(1, 4322,
+                      [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                          if (in_callback.fetch_add(1) != 0)
+                              ++overlapping_callbacks;
+                          std::this_thread::sleep_for(std::chrono::microseconds(10));
+                          ++num_async;
+                          in_callback.fetch_sub(1);
+                      }, 0, nullptr);
+    ASSERT_EQ(adiak_set_async_dispatch(1), 0);
+
+    const int n = 2000;
+    std::thread writer([]() {
+        for (int i = 0; i < n; ++i)
+            adiak_namevalue("async.list", 4322, nullptr, "%d", i);
+    });
+    while (num_async.load() < n) {
+        adiak_list_namevals(1, 4322,
+                            [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                                if (in_callback.fetch_add(1) != 0)
+                                    ++overlapping_callbacks;
+                                std::this_thread::sleep_for(std::chrono::microseconds(10));
+                                ++num_listed;
+                                in_callback.fetch_sub(1);
+                            }, nullptr);
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    writer.join();
+
+    EXPECT_EQ(adiak_flush(""), 0);
+    EXPECT_EQ(adiak_set_async_dispatch(0), 0);
+    EXPECT_EQ(num_async.load(), n);
+    EXPECT_GT(num_listed, 0);
+    EXPECT_EQ(overlapping_callbacks.load(), 0);
+}
+
+// A record is updated right away while another update's callback runs;
+// only its own callback waits.
+TEST(AdiakThreads, UpdateDuringCallback)
+{
+    static std::atomic<int> blocking(0);
+    static std::atomic<int> release(0);
+
+    adiak_register_cb(1, 4323,
+                      [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                          if (std::string(name) != "blocking.name")
+                              return;
+                          blocking = 1;
+                          while (!release.load())
+                              std::this_thread::sleep_for(std::chrono::microseconds(100));
+                      }, 0, nullptr);
+
+    std::thread blocked([]() { adiak_namevalue("blocking.name", 4323, nullptr, "%d", 1); });
+    while (!blocking.load())
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    std::thread writer([]() { adiak_namevalue("blocking.other", 4323, nullptr, "%d", 42); });
+    adiak_value_t* val = nullptr;
+    adiak_datatype_t* dtype = nullptr;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (adiak_get_nameval("blocking.other", &dtype, &val, nullptr, nullptr) != 0
+           && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    EXPECT_EQ(adiak_get_nameval("blocking.other", &dtype, &val, nullptr, nullptr), 0);
+
+    release = 1;
+    blocked.join();
+    writer.join();
+    ASSERT_EQ(adiak_get_nameval("blocking.other", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_int, 42);
+}
@@ -0,0 +1,782 @@
+#include <gtest/gtest.h>
+
+#include "adiak.hpp"
+#include "adiak_tool.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+TEST(AdiakToolAPI, InternedStrings)
+{
+    size_t num_strings_0 = 0, bytes_saved_0 = 0;
+    adiak_get_string_pool_stats(&num_strings_0, nullptr, &bytes_saved_0);
+
+    EXPECT_EQ(adiak_namevalue("intern:a", adiak_general, "subcat:intern", "%r", "category_a"), 0);
+    EXPECT_EQ(adiak_namevalue("intern:b", adiak_general, "subcat:intern", "%r", "category_a"), 0);
+    EXPECT_TRUE(adiak::value("intern:c", adiak::catstring("category_a"), adiak_general, "subcat:intern"));
+    EXPECT_EQ(adiak_namevalue("intern:d", adiak_general, "subcat:intern", "%s", "category_a"), 0);
+
+    size_t num_strings_1 = 0, bytes_used_1 = 0, bytes_saved_1 = 0;
+    adiak_get_string_pool_stats(&num_strings_1, &bytes_used_1, &bytes_saved_1);
+    EXPECT_GT(num_strings_1, num_strings_0);
+    EXPECT_GT(bytes_used_1, 0u);
+    EXPECT_GE(bytes_saved_1, bytes_saved_0 + 2 * strlen("category_a") + 3 * strlen("subcat:intern"));
+
+    const char* interned = adiak_intern_string("category_a");
+    const char* subcat = adiak_intern_string("subcat:intern");
+    EXPECT_STREQ(interned, "category_a");
+    EXPECT_EQ(adiak_intern_string(nullptr), nullptr);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    const char* rec_subcat = nullptr;
+
+    for (const char* name : { "intern:a", "intern:b", "intern:c" }) {
+        EXPECT_EQ(adiak_get_nameval(name, &dtype, &val, nullptr, &rec_subcat), 0);
+        EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_catstring);
+        EXPECT_EQ(static_cast<const char*>(val->v_ptr), interned);
+        EXPECT_EQ(rec_subcat, subcat);
+    }
+
+    // plain strings are copied, not interned
+    EXPECT_EQ(adiak_get_nameval("intern:d", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "category_a");
+    EXPECT_NE(static_cast<const char*>(val->v_ptr), interned);
+
+    // overwriting an interned value must not free the shared copy
+    EXPECT_EQ(adiak_namevalue("intern:a", adiak_general, "subcat:intern", "%r", "category_b"), 0);
+    EXPECT_EQ(adiak_get_nameval("intern:b", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "category_a");
+}
+
+TEST(AdiakToolAPI, NameHandles)
+{
+    adiak_name_handle_t h = adiak_get_handle("handle:iter", adiak_performance, "subcat:handle", "%d");
+    ASSERT_NE(h, nullptr);
+    EXPECT_EQ(adiak_get_handle("handle:bad", adiak_general, nullptr, "%q"), nullptr);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    int category = 0;
+    const char* subcat = nullptr;
+
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(adiak_update_handle(h, i), 0);
+
+    EXPECT_EQ(adiak_get_nameval("handle:iter", &dtype, &val, &category, &subcat), 0);
+    EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_int);
+    EXPECT_EQ(val->v_int, 9);
+    EXPECT_EQ(category, adiak_performance);
+    EXPECT_STREQ(subcat, "subcat:handle");
+
+    // a regular namevalue call and a handle update refer to the same record
+    EXPECT_EQ(adiak_namevalue("handle:iter", adiak_performance, "subcat:handle", "%d", 42), 0);
+    EXPECT_EQ(adiak_update_handle(h, 43), 0);
+    EXPECT_EQ(adiak_get_nameval("handle:iter", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(val->v_int, 43);
+
+    adiak_name_handle_t hs = adiak_get_handle("handle:str", adiak_general, nullptr, "%s");
+    EXPECT_EQ(adiak_update_handle(hs, "first"), 0);
+    EXPECT_EQ(adiak_update_handle(hs, "second"), 0);
+    EXPECT_EQ(adiak_get_nameval("handle:str", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "second");
+
+    int arr[3] = { 1, 2, 3 };
+    adiak_name_handle_t hl = adiak_get_handle("handle:list", adiak_general, nullptr, "{%d}");
+    EXPECT_EQ(adiak_update_handle(hl, arr, 3), 0);
+    EXPECT_EQ(adiak_update_handle(hl, arr, 2), 0);
+    EXPECT_EQ(adiak_get_nameval("handle:list", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_num_subvals(dtype), 2);
+
+    // raw-only handles can't be updated through the varargs interface
+    adiak_name_handle_t hr = adiak_get_handle("handle:raw", adiak_general, nullptr, nullptr);
+    EXPECT_EQ(adiak_update_handle(hr, 1), -1);
+
+    adiak::handle<double> hd("handle:cxx", adiak_performance);
+    EXPECT_TRUE(hd.update(1.5));
+    EXPECT_TRUE(hd.update(2.5));
+    EXPECT_EQ(adiak_get_nameval("handle:cxx", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_double);
+    EXPECT_DOUBLE_EQ(val->v_double, 2.5);
+}
+
+TEST(AdiakToolAPI, InPlaceUpdate)
+{
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+
+    EXPECT_EQ(adiak_namevalue("inplace:x", adiak_performance, nullptr, "%f", 1.0), 0);
+    EXPECT_EQ(adiak_get_nameval("inplace:x", &dtype, &val, nullptr, nullptr), 0);
+    adiak_datatype_t* dtype_0 = dtype;
+    adiak_value_t* val_0 = val;
+
+    // re-setting with the same type keeps the value storage and datatype
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(adiak_namevalue("inplace:x", adiak_performance, nullptr, "%f", 2.0 + i), 0);
+    EXPECT_TRUE(adiak::value("inplace:x", 20.0, adiak_performance));
+
+    EXPECT_EQ(adiak_get_nameval("inplace:x", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype, dtype_0);
+    EXPECT_EQ(val, val_0);
+    EXPECT_DOUBLE_EQ(val->v_double, 20.0);
+
+    // changing the type replaces the datatype but not the value storage
+    EXPECT_EQ(adiak_namevalue("inplace:x", adiak_performance, nullptr, "%s", "twenty"), 0);
+    EXPECT_EQ(adiak_get_nameval("inplace:x", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->dtype, adiak_type_t::adiak_string);
+    EXPECT_EQ(val, val_0);
+    EXPECT_STREQ(static_cast<const char*>(val->v_ptr), "twenty");
+}
+
+TEST(AdiakToolAPI, ListInInsertionOrder)
+{
+    for (int i = 0; i < 500; ++i)
+        adiak_namevalue(("order:" + std::to_string(i)).c_str(), 2001, nullptr, "%d", i);
+    // updating an existing record keeps its position
+    adiak_namevalue("order:0", 2001, nullptr, "%d", 0);
+
+    std::vector<int> seen;
+    adiak_list_namevals(1, 2001,
+                        [](const char*, int, const char*, adiak_value_t* val, adiak_datatype_t*, void* p) {
+                            static_cast<std::vector<int>*>(p)->push_back(val->v_int);
+                        }, &seen);
+
+    ASSERT_EQ(seen.size(), 500u);
+    for (int i = 0; i < 500; ++i)
+        EXPECT_EQ(seen[i], i);
+}
+
+TEST(AdiakToolAPI, CategoryIndex)
+{
+    const int cat_a = 3001, cat_b = 3002;
+
+    EXPECT_EQ(adiak_count_namevals(cat_a), 0);
+    int total = adiak_count_namevals(adiak_category_all);
+
+    for (int i = 0; i < 100; ++i)
+        adiak_namevalue(("catidx:" + std::to_string(i)).c_str(), (i % 4 == 0) ? cat_b : cat_a, nullptr, "%d", i);
+
+    EXPECT_EQ(adiak_count_namevals(cat_a), 75);
+    EXPECT_EQ(adiak_count_namevals(cat_b), 25);
+    EXPECT_EQ(adiak_count_namevals(adiak_category_all), total + 100);
+
+    // moving a record to another category updates both
+    adiak_namevalue("catidx:1", cat_b, nullptr, "%d", 1);
+    EXPECT_EQ(adiak_count_namevals(cat_a), 74);
+    EXPECT_EQ(adiak_count_namevals(cat_b), 26);
+
+    std::vector<int> seen;
+    adiak_list_namevals(1, cat_b,
+                        [](const char*, int category, const char*, adiak_value_t* val, adiak_datatype_t*, void* p) {
+                            EXPECT_EQ(category, 3002);
+                            static_cast<std::vector<int>*>(p)->push_back(val->v_int);
+                        }, &seen);
+
+    // listed in insertion order
+    ASSERT_EQ(seen.size(), 26u);
+    EXPECT_EQ(seen[0], 0);
+    EXPECT_EQ(seen[1], 1);
+    EXPECT_EQ(seen[2], 4);
+}
+
+TEST(AdiakToolAPI, TypeCache)
+{
+    const char* a[3] = { "one", "two", "three" };
+    adiak_datatype_t* dtype_0 = nullptr;
+    adiak_datatype_t* dtype_1 = nullptr;
+    adiak_value_t* val = nullptr;
+
+    // the same compound type string and element counts share one datatype
+    EXPECT_EQ(adiak_namevalue("typecache:a", adiak_general, nullptr, "{%s}", a, 3), 0);
+    EXPECT_EQ(adiak_namevalue("typecache:b", adiak_general, nullptr, "{%s}", a, 3), 0);
+    EXPECT_EQ(adiak_get_nameval("typecache:a", &dtype_0, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_nameval("typecache:b", &dtype_1, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype_0, dtype_1);
+    EXPECT_EQ(adiak_new_datatype("{%s}", 3), dtype_0);
+
+    // different counts give a different datatype
+    EXPECT_EQ(adiak_namevalue("typecache:b", adiak_general, nullptr, "{%s}", a, 2), 0);
+    EXPECT_EQ(adiak_get_nameval("typecache:b", &dtype_1, &val, nullptr, nullptr), 0);
+    EXPECT_NE(dtype_0, dtype_1);
+    EXPECT_EQ(dtype_1->num_elements, 2);
+    EXPECT_EQ(dtype_0->num_elements, 3);
+
+    adiak_datatype_t* tuple = adiak_new_datatype("(%d, {%f})", 2, 2);
+    ASSERT_NE(tuple, nullptr);
+    EXPECT_EQ(adiak_new_datatype("(%d, {%f})", 2, 2), tuple);
+    EXPECT_NE(adiak_new_datatype("(%d, {%f})", 2, 3), tuple);
+    EXPECT_EQ(tuple->subtype[1]->num_elements, 2);
+}
+
+TEST(AdiakToolAPI, SharedTypes)
+{
+    // structurally equal datatypes from different sources are one object
+    std::vector<double> v { 1.0, 2.0, 3.0 };
+    EXPECT_TRUE(adiak::value("sharedtypes:cxx", v));
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    EXPECT_EQ(adiak_get_nameval("sharedtypes:cxx", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_new_datatype("{%f}", 3), dtype);
+
+    // equal element types are shared between different containers
+    adiak_datatype_t* list = adiak_new_datatype("{(%s,%d)}", 4, 2);
+    adiak_datatype_t* set = adiak_new_datatype("[(%s,%d)]", 7, 2);
+    ASSERT_NE(list, nullptr);
+    ASSERT_NE(set, nullptr);
+    EXPECT_NE(list, set);
+    EXPECT_EQ(list->subtype[0], set->subtype[0]);
+
+    // raw datatypes built by the caller are replaced by the shared ones
+    adiak_datatype_t* raw = static_cast<adiak_datatype_t*>(calloc(1, sizeof(adiak_datatype_t)));
+    raw->dtype = adiak_list;
+    raw->numerical = adiak_categorical;
+    raw->num_elements = 3;
+    raw->num_subtypes = 1;
+    raw->subtype = static_cast<adiak_datatype_t**>(malloc(sizeof(adiak_datatype_t*)));
+    raw->subtype[0] = adiak_get_basetype(adiak_double);
+    adiak_value_t* raw_val = static_cast<adiak_value_t*>(malloc(sizeof(adiak_value_t)));
+    raw_val->v_subval = static_cast<adiak_value_t*>(malloc(3 * sizeof(adiak_value_t)));
+    for (int i = 0; i < 3; ++i)
+        raw_val->v_subval[i].v_double = i;
+    EXPECT_EQ(adiak_raw_namevalue("sharedtypes:raw", adiak_general, nullptr, raw_val, raw), 0);
+    EXPECT_EQ(adiak_get_nameval("sharedtypes:raw", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_new_datatype("{%f}", 3), dtype);
+}
+
+TEST(AdiakToolAPI, TypestrErrors)
+{
+    int offset = -1;
+
+    EXPECT_NE(adiak_new_datatype("{(%s, %d)}", 5, 2), nullptr);
+    EXPECT_EQ(adiak_get_typestr_error(&offset), nullptr);
+
+    EXPECT_EQ(adiak_new_datatype("{%d", 5), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "expected '}'");
+    EXPECT_EQ(offset, 3);
+
+    EXPECT_EQ(adiak_new_datatype("[%q]", 5), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "unknown type specifier");
+    EXPECT_EQ(offset, 2);
+
+    EXPECT_EQ(adiak_new_datatype("(%d, %s, %f)", 2), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "tuple has more elements than its count");
+    EXPECT_EQ(offset, 9);
+
+    EXPECT_EQ(adiak_new_datatype("(%d)", 2), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "tuple has fewer elements than its count");
+
+    EXPECT_EQ(adiak_new_datatype("%u12"), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "invalid size for type specifier");
+
+    EXPECT_EQ(adiak_new_datatype("<%f> x"), nullptr);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "unexpected characters after type");
+    EXPECT_EQ(offset, 5);
+
+    EXPECT_EQ(adiak_namevalue("typestr:bad", adiak_general, nullptr, "{%d]", nullptr, 0), -1);
+    EXPECT_STREQ(adiak_get_typestr_error(&offset), "expected '}'");
+    EXPECT_EQ(offset, 3);
+}
+
+TEST(AdiakToolAPI, FlatTypes)
+{
+    adiak_datatype_t* t = adiak_new_datatype("{(%s, [%d], <%f>)}", 4, 3, 2);
+    ASSERT_NE(t, nullptr);
+
+    int n = 0;
+    const adiak_flat_type_t* flat = adiak_get_flat_type(t, &n);
+    ASSERT_NE(flat, nullptr);
+    // list, tuple, string, set, int, range, double
+    ASSERT_EQ(n, 7);
+    EXPECT_EQ(flat[0].type, t);
+    EXPECT_EQ(flat[0].dtype, adiak_list);
+    EXPECT_EQ(flat[0].num_elements, 4);
+    EXPECT_EQ(flat[0].subtree_size, 7);
+    EXPECT_EQ(flat[1].type, t->subtype[0]);
+    EXPECT_EQ(flat[1].num_subtypes, 3);
+
+    int set = adiak_flat_subtype(flat, 1, 1);
+    int range = adiak_flat_subtype(flat, 1, 2);
+    EXPECT_EQ(set, 3);
+    EXPECT_EQ(flat[set].dtype, adiak_set);
+    EXPECT_EQ(flat[set].num_elements, 2);
+    EXPECT_EQ(flat[set + 1].dtype, adiak_int);
+    EXPECT_EQ(range, 5);
+    EXPECT_EQ(flat[range].dtype, adiak_range);
+    EXPECT_EQ(flat[adiak_flat_subtype(flat, range, 0)].type, t->subtype[0]->subtype[2]->subtype[0]);
+    EXPECT_EQ(adiak_flat_subtype(flat, 1, 3), -1);
+
+    // the flat form of a subtype is shared, too
+    int sub_n = 0;
+    const adiak_flat_type_t* sub = adiak_get_flat_type(t->subtype[0], &sub_n);
+    ASSERT_NE(sub, nullptr);
+    EXPECT_EQ(sub_n, 6);
+    EXPECT_EQ(sub[2].dtype, adiak_set);
+
+    const adiak_flat_type_t* base = adiak_get_flat_type(adiak_new_datatype("%d"), &n);
+    ASSERT_NE(base, nullptr);
+    EXPECT_EQ(n, 1);
+    EXPECT_EQ(base->dtype, adiak_int);
+}
+
+TEST(AdiakToolAPI, BlockCopiedValues)
+{
+    const char* strs[4] = { "alpha", "beta", "gamma", "delta" };
+    struct entry { const char* s; long long i; } entries[2] = { { "one", 1 }, { "two", 2 } };
+
+    EXPECT_EQ(adiak_namevalue("block:strs", adiak_general, nullptr, "[%s]", strs, 4), 0);
+    EXPECT_EQ(adiak_namevalue("block:tuples", adiak_general, nullptr, "{(%s,%lld)}", entries, 2, 2), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    EXPECT_EQ(adiak_get_nameval("block:strs", &dtype, &val, nullptr, nullptr), 0);
+    ASSERT_EQ(dtype->num_elements, 4);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_STREQ(static_cast<const char*>(val->v_subval[i].v_ptr), strs[i]);
+        EXPECT_NE(val->v_subval[i].v_ptr, strs[i]);
+    }
+
+    // nested values and strings are copied into the same allocation
+    EXPECT_EQ(adiak_get_nameval("block:tuples", &dtype, &val, nullptr, nullptr), 0);
+    adiak_value_t* tuple = static_cast<adiak_value_t*>(val->v_subval[1].v_ptr);
+    EXPECT_STREQ(static_cast<const char*>(tuple[0].v_ptr), "two");
+    EXPECT_EQ(tuple[1].v_longlong, 2);
+    EXPECT_GT(static_cast<void*>(tuple), static_cast<void*>(val->v_subval));
+
+    // replacing block-copied and element-wise values frees both correctly
+    EXPECT_EQ(adiak_namevalue("block:strs", adiak_general, nullptr, "[%s]", strs, 2), 0);
+    EXPECT_TRUE(adiak::value("block:strs", std::vector<std::string> { "x", "y" }));
+    EXPECT_EQ(adiak_namevalue("block:strs", adiak_general, nullptr, "[%s]", strs, 3), 0);
+    EXPECT_EQ(adiak_get_nameval("block:strs", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->num_elements, 3);
+}
+
+TEST(AdiakToolAPI, PackedArrays)
+{
+    // numeric lists and sets are only packed once a tool asked for it
+    adiak_register_cb(2, 4343, [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {},
+                      0, nullptr);
+
+    const float f32s[5] = { 1.5f, 2.5f, -3.5f, 4.5f, 5.5f };
+    const unsigned char u8s[4] = { 3, 4, 5, 6 };
+    const char* strs[2] = { "a", "b" };
+
+    EXPECT_EQ(adiak_namevalue("packed:f32", adiak_general, nullptr, "{%f32}", f32s, 5), 0);
+    EXPECT_EQ(adiak_namevalue("packed:u8", adiak_general, nullptr, "[%u8]", u8s, 4), 0);
+    EXPECT_EQ(adiak_namevalue("packed:strs", adiak_general, nullptr, "{%s}", strs, 2), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_datatype_t* elem_type = nullptr;
+    adiak_value_t* val = nullptr;
+    void* ptr = nullptr;
+    int count = 0;
+
+    // numeric lists and sets are copied at their native width
+    EXPECT_EQ(adiak_get_nameval("packed:f32", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->is_reference, 2);
+    EXPECT_EQ(adiak_num_subvals(dtype), 5);
+    ASSERT_EQ(adiak_get_array(dtype, val, &ptr, &count, &elem_type), 0);
+    EXPECT_EQ(count, 5);
+    EXPECT_EQ(elem_type->dtype, adiak_double);
+    EXPECT_EQ(elem_type->num_bytes, 4u);
+    EXPECT_NE(ptr, static_cast<const void*>(f32s));
+    EXPECT_EQ(memcmp(ptr, f32s, sizeof(f32s)), 0);
+
+    adiak_datatype_t* subtype = nullptr;
+    adiak_value_t subval;
+    EXPECT_EQ(adiak_get_subval(dtype, val, 2, &subtype, &subval), 0);
+    EXPECT_FLOAT_EQ(subval.v_double, -3.5);
+
+    EXPECT_EQ(adiak_get_nameval("packed:u8", &dtype, &val, nullptr, nullptr), 0);
+    ASSERT_EQ(adiak_get_array(dtype, val, &ptr, &count, nullptr), 0);
+    EXPECT_EQ(count, 4);
+    EXPECT_EQ(static_cast<unsigned char*>(ptr)[3], 6);
+
+    // other containers keep one adiak_value_t per element
+    EXPECT_EQ(adiak_get_nameval("packed:strs", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(dtype->is_reference, 0);
+    EXPECT_EQ(adiak_get_array(dtype, val, &ptr, &count, &elem_type), -1);
+
+    // numeric reference containers are packed arrays, too
+    EXPECT_EQ(adiak_namevalue("packed:ref", adiak_general, nullptr, "&{%u8}", u8s, 4), 0);
+    EXPECT_EQ(adiak_get_nameval("packed:ref", &dtype, &val, nullptr, nullptr), 0);
+    ASSERT_EQ(adiak_get_array(dtype, val, &ptr, &count, nullptr), 0);
+    EXPECT_EQ(ptr, static_cast<const void*>(u8s));
+
+    // replacing packed values frees them, but never a reference
+    EXPECT_EQ(adiak_namevalue("packed:f32", adiak_general, nullptr, "{%f32}", f32s, 2), 0);
+    EXPECT_EQ(adiak_namevalue("packed:ref", adiak_general, nullptr, "%d", 1), 0);
+    EXPECT_EQ(adiak_get_nameval("packed:f32", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_num_subvals(dtype), 2);
+
+    // numeric lists nested in other containers are widened to adiak_value_t
+    const signed char i8s[3] = { -1, 2, -3 };
+    const float nested[2][2] = { { 1.5f, 2.5f }, { 3.5f, 4.5f } };
+    EXPECT_EQ(adiak_namevalue("packed:tuple", adiak_general, nullptr, "({%i8})", i8s, 1, 3), 0);
+    EXPECT_EQ(adiak_namevalue("packed:nested", adiak_general, nullptr, "[{%f32}]", nested, 2, 2), 0);
+
+    EXPECT_EQ(adiak_get_nameval("packed:tuple", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 0, &subtype, &subval), 0);
+    EXPECT_EQ(adiak_get_array(subtype, &subval, &ptr, &count, nullptr), -1);
+    EXPECT_EQ(subval.v_subval[0].v_int, -1);
+    EXPECT_EQ(subval.v_subval[2].v_int, -3);
+
+    EXPECT_EQ(adiak_get_nameval("packed:nested", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 1, &subtype, &subval), 0);
+    EXPECT_DOUBLE_EQ(subval.v_subval[0].v_double, 3.5);
+    EXPECT_DOUBLE_EQ(subval.v_subval[1].v_double, 4.5);
+}
+
+TEST(AdiakToolAPI, ReferenceTupleOffsets)
+{
+    // tuple input is packed: char*, int, float, then an inline list of 2 shorts
+    static unsigned char data[sizeof(char*) + 4 + 4 + 4];
+    static const char* str = "ref";
+    const int i = 7;
+    const float f = 2.5f;
+    const int16_t shorts[2] = { -1, 300 };
+    memcpy(data, &str, sizeof(char*));
+    memcpy(data + sizeof(char*), &i, 4);
+    memcpy(data + sizeof(char*) + 4, &f, 4);
+    memcpy(data + sizeof(char*) + 8, shorts, 4);
+
+    EXPECT_EQ(adiak_namevalue("offsets:tuple", adiak_general, nullptr, "&(%s,%d,%f32,{%i16})", data, 4, 2), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    adiak_datatype_t* subtype = nullptr;
+    adiak_value_t subval;
+    EXPECT_EQ(adiak_get_nameval("offsets:tuple", &dtype, &val, nullptr, nullptr), 0);
+    ASSERT_EQ(adiak_num_subvals(dtype), 4);
+
+    // access elements out of order
+    EXPECT_EQ(adiak_get_subval(dtype, val, 2, &subtype, &subval), 0);
+    EXPECT_FLOAT_EQ(subval.v_double, 2.5);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 1, &subtype, &subval), 0);
+    EXPECT_EQ(subval.v_int, 7);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 0, &subtype, &subval), 0);
+    EXPECT_STREQ(static_cast<const char*>(subval.v_ptr), "ref");
+    EXPECT_EQ(adiak_get_subval(dtype, val, 3, &subtype, &subval), 0);
+    EXPECT_EQ(subtype->dtype, adiak_list);
+
+    adiak_datatype_t* inner_type = nullptr;
+    adiak_value_t inner;
+    EXPECT_EQ(adiak_get_subval(subtype, &subval, 1, &inner_type, &inner), 0);
+    EXPECT_EQ(inner.v_int, 300);
+    EXPECT_EQ(adiak_get_subval(dtype, val, 4, &subtype, &subval), -1);
+}
+
+namespace
+{
+
+// Flattens nested container values into a list of strings
+int collect_subvals(int, adiak_datatype_t* t, adiak_value_t* v, void* p)
+{
+    std::vector<std::string>* out = static_cast<std::vector<std::string>*>(p);
+    switch (t->dtype) {
+    case adiak_int:
+        out->push_back(std::to_string(v->v_int));
+        break;
+    case adiak_longlong:
+        out->push_back(std::to_string(v->v_longlong));
+        break;
+    case adiak_double:
+        out->push_back(std::to_string(v->v_double));
+        break;
+    case adiak_string:
+        out->push_back(static_cast<const char*>(v->v_ptr));
+        break;
+    case adiak_list:
+    case adiak_set:
+    case adiak_range:
+    case adiak_tuple:
+        return adiak_foreach_subval(t, v, collect_subvals, p);
+    default:
+        out->push_back("?");
+    }
+    return 0;
+}
+
+}
+
+TEST(AdiakToolAPI, ForeachSubval)
+{
+    struct entry { const char* s; long long i; } entries[2] = { { "one", 1 }, { "two", 2 } };
+    const float f32s[3] = { 0.5f, 1.5f, 2.5f };
+    const int16_t grid[2][2] = { { 1, 2 }, { 3, 4 } };
+
+    EXPECT_EQ(adiak_namevalue("foreach:tuples", adiak_general, nullptr, "{(%s,%lld)}", entries, 2, 2), 0);
+    EXPECT_EQ(adiak_namevalue("foreach:packed", adiak_general, nullptr, "{%f32}", f32s, 3), 0);
+    EXPECT_EQ(adiak_namevalue("foreach:ref", adiak_general, nullptr, "&{{%i16}}", grid, 2, 2), 0);
+
+    adiak_datatype_t* dtype = nullptr;
+    adiak_value_t* val = nullptr;
+    std::vector<std::string> out;
+
+    EXPECT_EQ(adiak_get_nameval("foreach:tuples", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_foreach_subval(dtype, val, collect_subvals, &out), 0);
+    EXPECT_EQ(out, (std::vector<std::string> { "one", "1", "two", "2" }));
+
+    out.clear();
+    EXPECT_EQ(adiak_get_nameval("foreach:packed", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_foreach_subval(dtype, val, collect_subvals, &out), 0);
+    EXPECT_EQ(out, (std::vector<std::string> { "0.500000", "1.500000", "2.500000" }));
+
+    out.clear();
+    EXPECT_EQ(adiak_get_nameval("foreach:ref", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_foreach_subval(dtype, val, collect_subvals, &out), 0);
+    EXPECT_EQ(out, (std::vector<std::string> { "1", "2", "3", "4" }));
+
+    // the callback can stop the iteration
+    int visited = 0;
+    EXPECT_EQ(adiak_foreach_subval(dtype, val,
+                                   [](int i, adiak_datatype_t*, adiak_value_t*, void* p) {
+                                       *static_cast<int*>(p) = i;
+                                       return i == 0 ? 0 : 42;
+                                   }, &visited), 42);
+    EXPECT_EQ(visited, 1);
+
+    EXPECT_EQ(adiak_get_nameval("foreach:packed", &dtype, &val, nullptr, nullptr), 0);
+    EXPECT_EQ(adiak_foreach_subval(dtype->subtype[0], val, collect_subvals, &out), -1);
+}
+
+TEST(AdiakToolAPI, CategoryDispatch)
+{
+    static int count_a = 0, count_b = 0;
+    const int cat = 1234;
+
+    adiak_register_cb(1, cat, [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                          ++count_a;
+                      }, 0, nullptr);
+
+    EXPECT_EQ(adiak_namevalue("dispatch:a", cat, nullptr, "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("dispatch:other", cat + 1, nullptr, "%d", 1), 0);
+    EXPECT_EQ(count_a, 1);
+
+    // tools registered later receive the category, too
+    adiak_register_cb_with_info(1, cat, [](const char*, adiak_value_t*, adiak_datatype_t*, adiak_record_info_t* info, void*) {
+                                    EXPECT_EQ(info->category, 1234);
+                                    ++count_b;
+                                }, 0, nullptr);
+
+    EXPECT_EQ(adiak_namevalue("dispatch:a", cat, nullptr, "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("dispatch:other", cat + 1, nullptr, "%d", 2), 0);
+    EXPECT_EQ(count_a, 2);
+    EXPECT_EQ(count_b, 1);
+}
+
+TEST(AdiakToolAPI, BatchCallbacks)
+{
+    static std::vector<std::vector<std::string>> batches;
+    static std::vector<int> values;
+    const int cat = 2345;
+
+    adiak_register_batch_cb(1, cat, [](adiak_batch_entry_t* entries, int n, void*) {
+                                std::vector<std::string> names;
+                                for (int i = 0; i < n; ++i) {
+                                    EXPECT_EQ(entries[i].info->category, 2345);
+                                    names.push_back(entries[i].name);
+                                    values.push_back(entries[i].value->v_int);
+                                }
+                                batches.push_back(names);
+                            }, 3, 0, nullptr);
+
+    // a name set twice is delivered once, with its latest value
+    EXPECT_EQ(adiak_namevalue("batch:a", cat, nullptr, "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("batch:b", cat, nullptr, "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("batch:a", cat, nullptr, "%d", 3), 0);
+    EXPECT_EQ(adiak_namevalue("batch:other", cat + 1, nullptr, "%d", 0), 0);
+    EXPECT_TRUE(batches.empty());
+    EXPECT_EQ(adiak_namevalue("batch:c", cat, nullptr, "%d", 4), 0);
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0], (std::vector<std::string> { "batch:a", "batch:b", "batch:c" }));
+    EXPECT_EQ(values, (std::vector<int> { 3, 2, 4 }));
+
+    // flush delivers the rest
+    EXPECT_EQ(adiak_namevalue("batch:b", cat, nullptr, "%d", 5), 0);
+    EXPECT_EQ(adiak_flush(""), 0);
+    ASSERT_EQ(batches.size(), 2u);
+    EXPECT_EQ(batches[1], std::vector<std::string> { "batch:b" });
+    EXPECT_EQ(values.back(), 5);
+
+    // nothing pending, nothing delivered
+    EXPECT_EQ(adiak_flush(""), 0);
+    EXPECT_EQ(batches.size(), 2u);
+}
+
+TEST(AdiakToolAPI, FilteredCallbacks)
+{
+    static std::vector<std::string> by_name, by_subcategory;
+    const int cat = 3456;
+
+    adiak_register_cb_filtered(1, cat, "filter:exact,filter:pre*,filter:g?ob*x", nullptr,
+                               [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+                                   by_name.push_back(name);
+                               }, 0, nullptr);
+    adiak_register_cb_with_info_filtered(1, cat, "filter:*", "keep,also",
+                                         [](const char* name, adiak_value_t*, adiak_datatype_t*, adiak_record_info_t*, void*) {
+                                             by_subcategory.push_back(name);
+                                         }, 0, nullptr);
+
+    const char* names[] = { "filter:exact", "filter:exactly", "filter:prefix", "filter:pr",
+                            "filter:glob.x", "filter:globx", "filter:glob.y", "other:exact" };
+    for (const char* name : names)
+        EXPECT_EQ(adiak_namevalue(name, cat, "keep", "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("filter:exact", cat, "drop", "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("filter:nosub", cat, nullptr, "%d", 3), 0);
+    EXPECT_EQ(adiak_namevalue("filter:also", cat, "also", "%d", 4), 0);
+
+    EXPECT_EQ(by_name, (std::vector<std::string> { "filter:exact", "filter:prefix", "filter:glob.x",
+                                                   "filter:globx", "filter:exact" }));
+    EXPECT_EQ(by_subcategory, (std::vector<std::string> { "filter:exact", "filter:exactly", "filter:prefix",
+                                                          "filter:pr", "filter:glob.x", "filter:globx",
+                                                          "filter:glob.y", "filter:also" }));
+}
+
+TEST(AdiakToolAPI, ListSinceGeneration)
+{
+    static std::vector<std::string> names;
+    const int cat = 4567;
+    auto collect = [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+        names.push_back(name);
+    };
+
+    EXPECT_EQ(adiak_namevalue("since:a", cat, nullptr, "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("since:b", cat, nullptr, "%d", 1), 0);
+    unsigned long long gen = adiak_list_namevals_since(1, cat, 0, collect, nullptr);
+    EXPECT_EQ(names, (std::vector<std::string> { "since:a", "since:b" }));
+
+    // nothing changed
+    names.clear();
+    EXPECT_EQ(adiak_list_namevals_since(1, cat, gen, collect, nullptr), gen);
+    EXPECT_TRUE(names.empty());
+
+    // updated names are listed once, in the order of their latest update
+    EXPECT_EQ(adiak_namevalue("since:a", cat, nullptr, "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("since:c", cat, nullptr, "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("since:other", cat + 1, nullptr, "%d", 2), 0);
+    EXPECT_EQ(adiak_namevalue("since:a", cat, nullptr, "%d", 3), 0);
+    unsigned long long next = adiak_list_namevals_since(1, cat, gen, collect, nullptr);
+    EXPECT_GT(next, gen);
+    EXPECT_EQ(names, (std::vector<std::string> { "since:c", "since:a" }));
+
+    // many updates of a few names don't pile up in the listing
+    for (int i = 0; i < 10000; ++i)
+        adiak_namevalue(i % 2 ? "since:a" : "since:b", cat, nullptr, "%d", i);
+    names.clear();
+    adiak_list_namevals_since(1, cat, next, collect, nullptr);
+    EXPECT_EQ(names, (std::vector<std::string> { "since:b", "since:a" }));
+}
+
+// adiak_t and tools as laid out by older library copies, which share them
+// with this one through adiak_public
+struct older_adiak_tool_t {
+    int version;
+    older_adiak_tool_t* next;
+    older_adiak_tool_t* prev;
+    void* opaque_val;
+    adiak_nameval_cb_t name_val_cb;
+    int report_on_all_ranks;
+    int category;
+    adiak_nameval_info_cb_t nameval_info_cb;
+};
+
+struct older_record_t {
+    const char* name;
+    int category;
+    const char* subcategory;
+    adiak_value_t* value;
+    adiak_datatype_t* dtype;
+    older_record_t* list_next;
+    older_record_t* hash_next;
+    adiak_record_info_t* info;
+};
+
+struct older_adiak_t {
+    int minimum_version;
+    int version;
+    int report_on_all_ranks;
+    int reportable_rank;
+    older_adiak_tool_t** tool_list;
+    int use_mpi;
+    older_record_t* shared_record_list;
+};
+
+extern "C" older_adiak_t adiak_public;
+
+TEST(AdiakToolAPI, OlderCopyTools)
+{
+    static std::vector<std::string> names;
+    const int cat = 5678;
+
+    // make sure the tool list exists
+    adiak_register_cb_filtered(1, cat, "older:a", nullptr,
+                               [](const char*, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) { },
+                               0, nullptr);
+
+    // allocated with the older size, so reading past it is caught by ASan
+    older_adiak_tool_t* tool = static_cast<older_adiak_tool_t*>(calloc(1, sizeof(older_adiak_tool_t)));
+    ASSERT_NE(tool, nullptr);
+    tool->version = 1;
+    tool->category = cat;
+    tool->name_val_cb = [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+        names.push_back(name);
+    };
+    older_adiak_tool_t** tool_list = adiak_public.tool_list;
+    ASSERT_NE(tool_list, nullptr);
+    tool->next = *tool_list;
+    if (tool->next)
+        tool->next->prev = tool;
+    *tool_list = tool;
+
+    int ints[] = { 1, 2 };
+    EXPECT_EQ(adiak_namevalue("older:a", cat, nullptr, "%d", 1), 0);
+    EXPECT_EQ(adiak_namevalue("older:b", cat, nullptr, "{%d}", ints, 2), 0);
+    EXPECT_EQ(names, (std::vector<std::string> { "older:a", "older:b" }));
+
+    *tool_list = tool->next;
+    if (tool->next)
+        tool->next->prev = nullptr;
+    free(tool);
+}
+
+// Mixing library versions is not supported: records of an older copy are
+// listed, but have no generations, and older copies don't see ours.
+TEST(AdiakToolAPI, OlderCopyRecords)
+{
+    static std::vector<std::string> names;
+    const int cat = 6789;
+    auto collect = [](const char* name, int, const char*, adiak_value_t*, adiak_datatype_t*, void*) {
+        names.push_back(name);
+    };
+
+    EXPECT_EQ(adiak_namevalue("older:own", cat, nullptr, "%d", 1), 0);
+
+    adiak_value_t value;
+    value.v_int = 2;
+    older_record_t record = { "older:shared", cat, nullptr, &value, adiak_new_datatype("%d"), nullptr, nullptr,
+                              nullptr };
+    ASSERT_EQ(adiak_public.shared_record_list, nullptr);
+    adiak_public.shared_record_list = &record;
+
+    adiak_list_namevals(1, cat, collect, nullptr);
+    EXPECT_EQ(names, (std::vector<std::string> { "older:own", "older:shared" }));
+    EXPECT_EQ(adiak_count_namevals(cat), 2);
+
+    names.clear();
+    unsigned long long gen = adiak_list_namevals_since(1, cat, 0, collect, nullptr);
+    EXPECT_GT(gen, 0u);
+    EXPECT_EQ(names, std::vector<std::string> { "older:own" });
+
+    names.clear();
+    EXPECT_EQ(adiak_namevalue("older:own", cat, nullptr, "%d", 3), 0);
+    EXPECT_GT(adiak_list_namevals_since(1, cat, gen, collect, nullptr), gen);
+    EXPECT_EQ(names, std::vector<std::string> { "older:own" });
+
+    // our records stay off the shared list
+    EXPECT_EQ(adiak_public.shared_record_list, &record);
+    EXPECT_EQ(record.list_next, nullptr);
+
+    adiak_public.shared_record_list = nullptr;
+}